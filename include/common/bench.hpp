@@ -0,0 +1,100 @@
+#ifndef PBSL_BENCH_HPP
+#define PBSL_BENCH_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "timer.hpp"
+
+// summary of repeated measurements, in milliseconds
+struct Stats {
+    double min;
+    double median;
+    double p10;
+    double p90;
+    double p99;
+    double max;
+};
+
+// nearest-rank percentile of sorted samples
+inline auto Percentile(std::vector<double> const& sorted, double q) -> double {
+    size_t rank = static_cast<size_t>(std::ceil(q * static_cast<double>(sorted.size())));
+    return sorted[std::clamp<size_t>(rank, 1, sorted.size()) - 1];
+}
+
+inline auto Summarize(std::vector<double> samples) -> Stats {
+    std::sort(samples.begin(), samples.end());
+    return {
+            samples.front(),
+            Percentile(samples, 0.5),
+            Percentile(samples, 0.1),
+            Percentile(samples, 0.9),
+            Percentile(samples, 0.99),
+            samples.back()
+    };
+}
+
+// keeps a computed value observable, so that the computation producing it is not optimized away
+template<typename T>
+auto Consume(T const& value) -> void {
+    asm volatile("" : : "g"(&value) : "memory");
+}
+
+// times run(state) on a fresh state = setup() in each of the repetitions; setup is not timed
+template<typename Setup, typename Run>
+auto Repeat(size_t reps, Setup&& setup, Run&& run) -> std::vector<double> {
+    std::vector<double> samples;
+    for (size_t i = 0; i < reps; ++i) {
+        auto state = setup();
+        samples.push_back(MeasureTimeMillisPrecise([&]() {
+            if constexpr (std::is_void_v<decltype(run(state))>) {
+                run(state);
+            } else {
+                Consume(run(state));
+            }
+        }));
+    }
+    return samples;
+}
+
+// one measured configuration
+struct Row {
+    std::string impl;
+    std::string op;
+    std::string distribution;
+    size_t threads;
+    size_t initial_size;
+    size_t batch_size;
+    size_t reps;
+    Stats stats;
+};
+
+inline auto CsvHeader() -> std::string {
+    return "impl,op,distribution,threads,n,m,reps,min_ms,median_ms,p10_ms,p90_ms,p99_ms,max_ms";
+}
+
+inline auto ToCsv(Row const& row) -> std::string {
+    std::ostringstream out;
+    out << row.impl << ',' << row.op << ',' << row.distribution << ',' << row.threads << ','
+        << row.initial_size << ',' << row.batch_size << ',' << row.reps << ','
+        << row.stats.min << ',' << row.stats.median << ',' << row.stats.p10 << ','
+        << row.stats.p90 << ',' << row.stats.p99 << ',' << row.stats.max;
+    return out.str();
+}
+
+// a single-line JSON object
+inline auto ToJson(Row const& row) -> std::string {
+    std::ostringstream out;
+    out << "{\"impl\": \"" << row.impl << "\", \"op\": \"" << row.op << "\", \"distribution\": \"" << row.distribution
+        << "\", \"threads\": " << row.threads << ", \"n\": " << row.initial_size << ", \"m\": " << row.batch_size
+        << ", \"reps\": " << row.reps << ", \"min_ms\": " << row.stats.min << ", \"median_ms\": " << row.stats.median
+        << ", \"p10_ms\": " << row.stats.p10 << ", \"p90_ms\": " << row.stats.p90
+        << ", \"p99_ms\": " << row.stats.p99 << ", \"max_ms\": " << row.stats.max << "}";
+    return out.str();
+}
+
+#endif //PBSL_BENCH_HPP
@@ -4,61 +4,119 @@
 #include <parlay/sequence.h>
 #include <parlay/primitives.h>
 
-#include <random>
+#include <functional>
+#include <optional>
+#include <string>
 
 #include "config.hpp"
 #include "util.hpp"
+#include "pbsl/util.hpp"
 #include "timer.hpp"
 
+// how the batch keys are placed among the initial ones
+enum class Distribution {
+    kUniform,      // a uniformly random subset of all keys
+    kClustered,    // a few contiguous runs of keys
+    kSkewed,       // dense at the low end of the key range and sparse at the high end
+    kAppend,       // all greater than the initial keys
+    kInterleaved,  // evenly spaced, so every gap of the initial keys receives the same number
+};
+
+inline auto constexpr kDistributions = {
+        Distribution::kUniform, Distribution::kClustered, Distribution::kSkewed,
+        Distribution::kAppend, Distribution::kInterleaved
+};
+
+inline auto ToString(Distribution distribution) -> std::string {
+    switch (distribution) {
+        case Distribution::kUniform: return "uniform";
+        case Distribution::kClustered: return "clustered";
+        case Distribution::kSkewed: return "skewed";
+        case Distribution::kAppend: return "append";
+        case Distribution::kInterleaved: return "interleaved";
+    }
+    return "";
+}
+
+inline auto ParseDistribution(std::string const& name) -> std::optional<Distribution> {
+    for (auto distribution : kDistributions) {
+        if (ToString(distribution) == name) return distribution;
+    }
+    return std::nullopt;
+}
+
 struct TestDescription {
     size_t n_proc;
     size_t initial_size;
     size_t batch_size;
+    Distribution distribution = Distribution::kUniform;
+    uint64_t seed = 0;
 };
 
-struct TestGroupDescription {
-    size_t n_proc;
-    std::vector<TestDescription> test_descriptions;
-};
-
+// initial and batch are sorted, disjoint, and together make up the keys 1, ..., initial_size + batch_size;
+// with a skewed distribution, the batch size is met in expectation only, and a clustered one may fall short by a few keys
 struct Test {
     parlay::sequence<size_t> initial;
     parlay::sequence<size_t> batch;
 };
 
-struct TestGroup {
-    std::vector<Test> tests;
+namespace detail {
 
-    auto Size() const -> size_t { return tests.size(); }
-};
+inline auto constexpr kClusters = 16;
 
-auto GenerateTest(TestDescription desc) -> Test {
-    //std::cout << "before keys\n";
-    auto keys = parlay::tabulate(desc.initial_size + desc.batch_size, [](size_t i) { return i + 1; });
-    //std::cout << "before shuffle\n";
-    keys = parlay::random_shuffle(keys);
-    //std::cout << "after shuffle\n";
-    //std::shuffle(keys.begin(), keys.end(), std::mt19937(std::random_device()()));
-    auto initial = keys.substr(0, desc.initial_size);
-    auto batch = keys.substr(desc.initial_size, desc.batch_size);
-    //std::cout << "before sort\n";
-    parlay::sort_inplace(initial);
-    parlay::sort_inplace(batch);
-    return Test(std::move(initial), std::move(batch));
+// a uniform double in [0, 1) that depends only on the seed and i
+inline auto UniformAt(uint64_t seed, size_t i) -> double {
+    return static_cast<double>(pbsl::util::random::Mix64(pbsl::util::random::Mix64(seed) + i) >> 11) * 0x1.0p-53;
+}
+
+// whether key i + 1 of `total` goes to the batch
+inline auto IsInBatch(TestDescription const& desc, size_t total, size_t i) -> bool {
+    size_t m = desc.batch_size;
+    switch (desc.distribution) {
+        case Distribution::kClustered: {
+            // the key range is cut into kClusters segments, each holding one run of batch keys at a random offset
+            size_t segment = (total + kClusters - 1) / kClusters;
+            size_t j = i / segment;
+            size_t length = std::min(segment, total - j * segment);
+            size_t run = std::min(length, m / kClusters + (j < m % kClusters));
+            size_t offset = static_cast<size_t>(UniformAt(desc.seed, j) * static_cast<double>(length - run + 1));
+            size_t k = i - j * segment;
+            return offset <= k && k < offset + run;
+        }
+        case Distribution::kSkewed: {
+            // density proportional to (1 - x)^3 on the key range scaled to [0, 1), whose integral is 1/4
+            double x = static_cast<double>(i) / static_cast<double>(total);
+            double density = 4.0 * static_cast<double>(m) / static_cast<double>(total) * (1 - x) * (1 - x) * (1 - x);
+            return UniformAt(desc.seed, i) < density;
+        }
+        case Distribution::kAppend:
+            return i >= total - m;
+        case Distribution::kInterleaved:
+            // i is in the batch when the multiples of total / m step over it
+            return (i + 1) * m / total != i * m / total;
+        case Distribution::kUniform:
+            break;
+    }
+    return false;
 }
 
-auto RunTest(Test test) -> size_t {
-    return 0;
 }
 
-template<typename C>
-auto RunTestGroup(TestGroup group) -> std::vector<size_t> {
-    std::vector<size_t> times(group.Size());
-    for (auto& test : group.tests) {
-        auto duration = RunTest(test);
-        times.push_back(duration);
+auto GenerateTest(TestDescription desc) -> Test {
+    size_t total = desc.initial_size + desc.batch_size;
+    auto keys = parlay::tabulate(total, [](size_t i) { return i + 1; });
+    if (desc.distribution == Distribution::kUniform) {
+        keys = parlay::random_shuffle(keys, desc.seed);
+        auto initial = keys.substr(0, desc.initial_size);
+        auto batch = keys.substr(desc.initial_size, desc.batch_size);
+        parlay::sort_inplace(initial);
+        parlay::sort_inplace(batch);
+        return Test(std::move(initial), std::move(batch));
     }
-    return times;
+    auto is_batch = parlay::tabulate(total, [&](size_t i) { return detail::IsInBatch(desc, total, i); });
+    auto batch = parlay::pack(keys, is_batch);
+    auto initial = parlay::pack(keys, parlay::map(is_batch, std::logical_not<>()));
+    return Test(std::move(initial), std::move(batch));
 }
 
 #endif //PBSL_TESTCASE_HPP
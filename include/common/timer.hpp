@@ -15,4 +15,16 @@ auto MeasureTimeMillis(F&& f) -> long {
     return duration_cast<milliseconds>(finish - start).count();
 }
 
+// same with sub-millisecond precision
+template<typename F>
+auto MeasureTimeMillisPrecise(F&& f) -> double {
+    using std::chrono::steady_clock;
+    using std::chrono::duration;
+
+    auto start = steady_clock::now();
+    f();
+    auto finish = steady_clock::now();
+    return duration<double, std::milli>(finish - start).count();
+}
+
 #endif //PBSL_TIMER_HPP
@@ -0,0 +1,59 @@
+#ifndef PBSL_AGGREGATE_HPP
+#define PBSL_AGGREGATE_HPP
+
+#include <algorithm>
+#include <concepts>
+#include <limits>
+
+namespace pbsl {
+
+// An aggregate that a skip list maintains for every link next to its span: the combination of Of(key, value)
+// over the nodes the link skips, in order. Combine must be associative with Identity as its identity;
+// it need not be commutative.
+template<typename A, typename K, typename V>
+concept Aggregate = requires(typename A::Type const& lhs, typename A::Type const& rhs, K const& key, V const& value) {
+    { A::Identity() } -> std::convertible_to<typename A::Type>;
+    { A::Combine(lhs, rhs) } -> std::convertible_to<typename A::Type>;
+    { A::Of(key, value) } -> std::convertible_to<typename A::Type>;
+};
+
+// Aggregate of skip lists that maintain spans only; it takes no room in the links.
+struct NoAggregate {
+    struct Type {};
+
+    static auto Identity() -> Type { return {}; }
+
+    static auto Combine(Type, Type) -> Type { return {}; }
+
+    template<typename K, typename V>
+    static auto Of(K const&, V const&) -> Type { return {}; }
+};
+
+// sum of the values, e.g. the total size of the objects in a key range
+template<typename T>
+struct SumOfValues {
+    using Type = T;
+
+    static auto Identity() -> T { return T{}; }
+
+    static auto Combine(T const& lhs, T const& rhs) -> T { return lhs + rhs; }
+
+    template<typename K>
+    static auto Of(K const&, T const& value) -> T { return value; }
+};
+
+template<typename T>
+struct MaxOfValues {
+    using Type = T;
+
+    static auto Identity() -> T { return std::numeric_limits<T>::lowest(); }
+
+    static auto Combine(T const& lhs, T const& rhs) -> T { return std::max(lhs, rhs); }
+
+    template<typename K>
+    static auto Of(K const&, T const& value) -> T { return value; }
+};
+
+}
+
+#endif //PBSL_AGGREGATE_HPP
@@ -0,0 +1,189 @@
+#ifndef PBSL_BATCHING_WRITER_HPP
+#define PBSL_BATCHING_WRITER_HPP
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <future>
+#include <limits>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <parlay/primitives.h>
+#include <parlay/sequence.h>
+
+#include "util.hpp"
+
+namespace pbsl {
+
+// A front-end for many threads that insert and erase one key at a time. Calls only append the operation to a
+// shared buffer and return a future; a worker thread takes the whole buffer once it holds max_batch_size
+// operations or its oldest one has waited max_delay, and applies it to the SkipList as one sorted batch,
+// then completes the futures of its operations.
+// The operations of a buffer take effect as if applied one by one in the order they were buffered.
+// While the writer exists, the list must not be moved or accessed other than through it. As long as no Erase is
+// submitted, it may also be read through snapshots; erasures unlink and free nodes that a snapshot may still visit.
+template<typename List>
+class BatchingWriter {
+  public:
+    using Key = typename List::Key;
+    using Value = typename List::Value;
+    using Entry = typename List::Entry;
+    template<typename T> using Seq = util::types::Seq<T>;
+
+    struct Limits {
+        size_t max_batch_size = 1 << 16;
+        std::chrono::microseconds max_delay{200};
+    };
+
+    explicit BatchingWriter(List& list, Limits limits = {})
+        : list_(list)
+        , limits_(limits)
+        , worker_([this]() { Run(); }) {
+    }
+
+    BatchingWriter(BatchingWriter const&) = delete;
+    auto operator=(BatchingWriter const&) -> BatchingWriter& = delete;
+
+    // applies the buffered operations; no call may run concurrently
+    ~BatchingWriter() {
+        {
+            std::lock_guard lock(mutex_);
+            stopping_ = true;
+        }
+        wakeup_.notify_one();
+        worker_.join();
+    }
+
+    // the future is ready once the key is in the list, with the value it had if it was present already
+    auto Insert(Key key) -> std::future<void> requires (!List::kHasValues) {
+        return Submit({.kind = kInsert, .key = std::move(key)});
+    }
+
+    auto Insert(Key key, Value value) -> std::future<void> requires List::kHasValues {
+        return Submit({.kind = kInsert, .key = std::move(key), .value = std::move(value)});
+    }
+
+    // must not be used while the list is read through snapshots
+    auto Erase(Key key) -> std::future<void> { return Submit({.kind = kErase, .key = std::move(key)}); }
+
+    // applies the buffered operations without waiting for the limits, and waits for them
+    auto Flush() -> void {
+        std::promise<void> promise;
+        auto future = promise.get_future();
+        {
+            std::lock_guard lock(mutex_);
+            flushes_.push_back(std::move(promise));
+        }
+        wakeup_.notify_one();
+        future.wait();
+    }
+
+  private:
+    enum Kind : uint8_t {
+        kInsert,
+        kErase,
+    };
+
+    struct Operation {
+        Kind kind;
+        Key key;
+        [[no_unique_address]] Value value{};
+    };
+
+    auto Submit(Operation operation) -> std::future<void> {
+        std::promise<void> promise;
+        auto future = promise.get_future();
+        bool wake = false;
+        {
+            std::lock_guard lock(mutex_);
+            if (operations_.empty()) oldest_ = std::chrono::steady_clock::now();
+            operations_.push_back(std::move(operation));
+            promises_.push_back(std::move(promise));
+            // the worker sleeps until the first operation arrives, then until the deadline or a full buffer
+            wake = operations_.size() == 1 || operations_.size() >= limits_.max_batch_size;
+        }
+        if (wake) wakeup_.notify_one();
+        return future;
+    }
+
+    auto Run() -> void {
+        std::unique_lock lock(mutex_);
+        while (true) {
+            wakeup_.wait(lock, [&]() { return stopping_ || !flushes_.empty() || !operations_.empty(); });
+            wakeup_.wait_until(lock, oldest_ + limits_.max_delay, [&]() {
+                return stopping_ || !flushes_.empty() || operations_.size() >= limits_.max_batch_size;
+            });
+            auto operations = std::exchange(operations_, {});
+            auto promises = std::exchange(promises_, {});
+            auto flushes = std::exchange(flushes_, {});
+            bool stopping = stopping_;
+            lock.unlock();
+            if (!operations.empty()) Apply(std::move(operations));
+            for (auto& promise : promises) promise.set_value();
+            for (auto& promise : flushes) promise.set_value();
+            if (stopping) return;
+            lock.lock();
+        }
+    }
+
+    // sorts the operations by key, keeping their order among equal keys. For each key, the list ends up as after
+    // its last erase, followed by its first insertion after that one, if any: keys with an erase are erased first,
+    // and the insertions then skip the keys that are present
+    auto Apply(Seq<Operation> operations) -> void {
+        parlay::stable_sort_inplace(operations, [](Operation const& lhs, Operation const& rhs) {
+            return List::Less(lhs.key, rhs.key);
+        });
+        size_t constexpr none = std::numeric_limits<size_t>::max();
+        auto starts = parlay::pack_index(parlay::tabulate(operations.size(), [&](size_t i) {
+            return i == 0 || List::Less(operations[i - 1].key, operations[i].key);
+        }));
+        // for the run of operations on each key, whether it erases the key and which operation inserts it
+        auto outcomes = parlay::tabulate(starts.size(), [&](size_t g) {
+            size_t end = g + 1 < starts.size() ? starts[g + 1] : operations.size();
+            bool erases = false;
+            size_t insert = none;
+            for (size_t i = starts[g]; i < end; ++i) {
+                if (operations[i].kind == kErase) {
+                    erases = true;
+                    insert = none;
+                } else if (insert == none) {
+                    insert = i;
+                }
+            }
+            return std::make_pair(erases, insert);
+        });
+        auto erased = parlay::pack(parlay::map(starts, [&](size_t i) { return operations[i].key; }),
+                                   parlay::map(outcomes, [](auto const& outcome) { return outcome.first; }));
+        auto inserts = parlay::filter(parlay::map(outcomes, [](auto const& outcome) { return outcome.second; }),
+                                      [&](size_t i) { return i != none; });
+        // not snapshot-safe: EraseOrdered splices with plain stores and frees the nodes right away
+        if (!erased.empty()) list_.EraseOrdered(erased);
+        if (inserts.empty()) return;
+        if constexpr (List::kHasValues) {
+            list_.Insert(parlay::map(inserts, [&](size_t i) { return Entry(operations[i].key, operations[i].value); }));
+        } else {
+            list_.Insert(parlay::map(inserts, [&](size_t i) { return operations[i].key; }));
+        }
+    }
+
+    List& list_;
+    Limits const limits_;
+    std::mutex mutex_;
+    std::condition_variable wakeup_;
+    // the buffer, and the promises of its operations in the same order
+    Seq<Operation> operations_;
+    std::vector<std::promise<void>> promises_;
+    std::vector<std::promise<void>> flushes_;
+    // when the first operation of the buffer arrived
+    std::chrono::steady_clock::time_point oldest_;
+    bool stopping_ = false;
+    std::thread worker_;
+};
+
+}
+
+#endif //PBSL_BATCHING_WRITER_HPP
@@ -1,20 +1,38 @@
 #ifndef PBSL_CONFIG_H
 #define PBSL_CONFIG_H
 
+#include <cstddef>
+#include <cstdint>
 #include <string>
 
 namespace pbsl::config {
 
-using Key = uint32_t;
+// default key type
+using Key = uint64_t;
 
+// probability that a node does not reach the next level; 1/2 takes the fastest path in height generation
 inline double constexpr p = 0.5;
+static_assert(0 < p && p < 1);
 
-inline bool constexpr DebugEnabled() { return true; }
+// seed of the hash that node heights are derived from; tunable at runtime
+inline uint64_t seed = 0x9e3779b97f4a7c15ULL;
+
+// upper bound on the height of a node, sentinels included
+inline size_t constexpr max_height = 64;
 
-namespace pbsl {
-struct Node;
+// batches of at most this many keys are inserted one by one with finger search instead of the parallel merge;
+// tunable at runtime, see TestSmallBatchCrossover
+inline size_t small_batch_size = 256;
+
+inline bool constexpr DebugEnabled() { return true; }
 
-class SkipList;
+// per-phase timings and counters of SkipList::GetStats; define PBSL_STATS to enable
+inline bool constexpr StatsEnabled() {
+#ifdef PBSL_STATS
+    return true;
+#else
+    return false;
+#endif
 }
 
 }
@@ -0,0 +1,179 @@
+#ifndef PBSL_FROZEN_INDEX_HPP
+#define PBSL_FROZEN_INDEX_HPP
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cassert>
+#include <cstdint>
+#include <functional>
+#include <span>
+#include <type_traits>
+#include <vector>
+
+#include <parlay/parallel.h>
+#include <parlay/primitives.h>
+#include <parlay/sequence.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#include "util.hpp"
+#include "node.hpp"
+
+namespace pbsl {
+
+// An immutable copy of a SkipList laid out for searching: a static B+-tree without pointers.
+// Level 0 holds the sorted keys; the i-th key of level j + 1 is the largest key of the i-th block of level j.
+// Every level is padded with its last key to whole blocks, so that a descent reads one block per level,
+// and blocks of integral keys are compared with a few vector instructions.
+template<typename K, typename V, typename Compare>
+class FrozenIndex {
+  public:
+    using Key = K;
+    using Value = V;
+    template<typename T> using Seq = util::types::Seq<T>;
+
+    static constexpr size_t kBlockSize = 16;
+
+    // keys must be sorted and unique; values hold the value of each key, or nothing with NoValue
+    FrozenIndex(Seq<Key> keys, Seq<Value> values) : size_(keys.size()), values_(std::move(values)) {
+        assert((std::is_same_v<Value, NoValue> || values_.size() == size_));
+        if (size_ == 0) return;
+        levels_.push_back(Padded(std::move(keys)));
+        while (levels_.back().size() > kBlockSize) {
+            auto const& below = levels_.back();
+            levels_.push_back(Padded(parlay::tabulate(below.size() / kBlockSize, [&](size_t i) {
+                return below[i * kBlockSize + kBlockSize - 1];
+            })));
+        }
+    }
+
+    auto Size() const -> size_t { return size_; }
+
+    auto IsEmpty() const -> bool { return size_ == 0; }
+
+    // number of keys smaller than key
+    auto Rank(Key const& key) const -> size_t {
+        if (IsEmpty() || Less(Last(), key)) return size_;
+        size_t position = 0;
+        for (size_t level = levels_.size(); level-- > 0;) position = SearchBlock(level, position, key);
+        return position;
+    }
+
+    // the key at the given 0-based position in sorted order; index must be less than Size()
+    auto Select(size_t index) const -> Key const& { return levels_[0][index]; }
+
+    auto Contains(Key const& key) const -> bool {
+        size_t position = Rank(key);
+        return position < size_ && !Less(key, levels_[0][position]);
+    }
+
+    // value stored with key, nullptr if it is absent
+    auto Find(Key const& key) const -> Value const* requires (!std::is_same_v<Value, NoValue>) {
+        size_t position = Rank(key);
+        return position < size_ && !Less(key, levels_[0][position]) ? &values_[position] : nullptr;
+    }
+
+    // whether each key is present; the keys may come in any order. As in SkipList::Contains, each worker
+    // descends with a group of keys at once, level by level, prefetching the block each one reads next
+    auto Contains(std::span<Key const> keys) const -> Seq<bool> {
+        auto result = Seq<bool>::uninitialized(keys.size());
+        size_t n_groups = (keys.size() + kLookupGroupSize - 1) / kLookupGroupSize;
+        parlay::parallel_for(0, n_groups, [&](size_t g) {
+            size_t begin = g * kLookupGroupSize;
+            size_t count = std::min(kLookupGroupSize, keys.size() - begin);
+            std::array<size_t, kLookupGroupSize> positions{};
+            std::array<bool, kLookupGroupSize> in_range{};
+            for (size_t i = 0; i < count; ++i) in_range[i] = !IsEmpty() && !Less(Last(), keys[begin + i]);
+            for (size_t level = levels_.size(); level-- > 0;) {
+                for (size_t i = 0; i < count; ++i) {
+                    if (!in_range[i]) continue;
+                    positions[i] = SearchBlock(level, positions[i], keys[begin + i]);
+                    if (level > 0) util::Prefetch(&levels_[level - 1][positions[i] * kBlockSize]);
+                }
+            }
+            for (size_t i = 0; i < count; ++i) {
+                result[begin + i] = in_range[i] && !Less(keys[begin + i], levels_[0][positions[i]]);
+            }
+        });
+        return result;
+    }
+
+    // bytes taken by the keys of all levels and the values
+    auto AllocatedBytes() const -> size_t {
+        size_t bytes = values_.size() * sizeof(Value);
+        for (auto const& level : levels_) bytes += level.size() * sizeof(Key);
+        return bytes;
+    }
+
+  private:
+    static constexpr size_t kLookupGroupSize = 16;
+
+    // integral keys under the natural order are compared with AVX2 where it is enabled
+    static constexpr bool kVectorKeys = std::is_integral_v<Key> && (sizeof(Key) == 4 || sizeof(Key) == 8)
+            && (std::is_same_v<Compare, std::less<Key>> || std::is_same_v<Compare, std::less<>>);
+
+    static auto Less(Key const& lhs, Key const& rhs) -> bool { return Compare{}(lhs, rhs); }
+
+    static auto Padded(Seq<Key> keys) -> Seq<Key> {
+        size_t padding = (kBlockSize - keys.size() % kBlockSize) % kBlockSize;
+        Key last = keys.back();
+        for (size_t i = 0; i < padding; ++i) keys.push_back(last);
+        return keys;
+    }
+
+    auto Last() const -> Key const& { return levels_[0][size_ - 1]; }
+
+    // position on `level` of the first key not less than key, which is known to lie in the given block
+    auto SearchBlock(size_t level, size_t block, Key const& key) const -> size_t {
+        Key const* keys = levels_[level].data() + block * kBlockSize;
+        return block * kBlockSize + CountLess(keys, key);
+    }
+
+    // number of the kBlockSize keys starting at keys that are less than key
+    static auto CountLess(Key const* keys, Key const& key) -> size_t {
+#if defined(__AVX2__)
+        if constexpr (kVectorKeys) return CountLessAvx2(keys, key);
+#endif
+        size_t count = 0;
+        for (size_t i = 0; i < kBlockSize; ++i) count += Less(keys[i], key);
+        return count;
+    }
+
+#if defined(__AVX2__)
+    // AVX2 compares signed integers only, so unsigned ones are shifted by flipping their sign bits
+    static auto CountLessAvx2(Key const* keys, Key const& key) -> size_t {
+        constexpr size_t kLanes = 32 / sizeof(Key);
+        size_t count = 0;
+        if constexpr (sizeof(Key) == 8) {
+            __m256i flip = _mm256_set1_epi64x(std::is_signed_v<Key> ? 0 : INT64_MIN);
+            __m256i needle = _mm256_xor_si256(_mm256_set1_epi64x(static_cast<int64_t>(key)), flip);
+            for (size_t i = 0; i < kBlockSize; i += kLanes) {
+                auto chunk = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(keys + i));
+                auto less = _mm256_cmpgt_epi64(needle, _mm256_xor_si256(chunk, flip));
+                count += std::popcount(static_cast<unsigned>(_mm256_movemask_pd(_mm256_castsi256_pd(less))));
+            }
+        } else {
+            __m256i flip = _mm256_set1_epi32(std::is_signed_v<Key> ? 0 : INT32_MIN);
+            __m256i needle = _mm256_xor_si256(_mm256_set1_epi32(static_cast<int32_t>(key)), flip);
+            for (size_t i = 0; i < kBlockSize; i += kLanes) {
+                auto chunk = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(keys + i));
+                auto less = _mm256_cmpgt_epi32(needle, _mm256_xor_si256(chunk, flip));
+                count += std::popcount(static_cast<unsigned>(_mm256_movemask_ps(_mm256_castsi256_ps(less))));
+            }
+        }
+        return count;
+    }
+#endif
+
+    size_t size_;
+    // levels_[0] holds the keys, levels_.back() a single block
+    std::vector<Seq<Key>> levels_;
+    Seq<Value> values_;
+};
+
+}
+
+#endif //PBSL_FROZEN_INDEX_HPP
@@ -0,0 +1,88 @@
+#ifndef PBSL_MAPPED_FILE_HPP
+#define PBSL_MAPPED_FILE_HPP
+
+#include <cstddef>
+#include <optional>
+#include <string>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace pbsl {
+
+// A whole file mapped into memory, unmapped when destroyed. Opened files are read-only;
+// created ones are writable and are written back to the file by Sync or when unmapped.
+class MappedFile {
+  public:
+    static auto Open(std::string const& path) -> std::optional<MappedFile> {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return std::nullopt;
+        struct stat st{};
+        if (::fstat(fd, &st) != 0) {
+            ::close(fd);
+            return std::nullopt;
+        }
+        return Map(fd, static_cast<size_t>(st.st_size), PROT_READ);
+    }
+
+    // creates or truncates the file at `path` to `size` zero bytes
+    static auto Create(std::string const& path, size_t size) -> std::optional<MappedFile> {
+        int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) return std::nullopt;
+        if (::ftruncate(fd, static_cast<off_t>(size)) != 0) {
+            ::close(fd);
+            return std::nullopt;
+        }
+        return Map(fd, size, PROT_READ | PROT_WRITE);
+    }
+
+    MappedFile(MappedFile&& other) noexcept
+        : data_(std::exchange(other.data_, nullptr))
+        , size_(std::exchange(other.size_, 0)) {}
+
+    auto operator=(MappedFile&& other) noexcept -> MappedFile& {
+        std::swap(data_, other.data_);
+        std::swap(size_, other.size_);
+        return *this;
+    }
+
+    ~MappedFile() {
+        if (data_ != nullptr) ::munmap(data_, size_);
+    }
+
+    auto Data() const -> std::byte* { return static_cast<std::byte*>(data_); }
+
+    auto Size() const -> size_t { return size_; }
+
+    // blocks until the written pages reach the file
+    auto Sync() const -> bool {
+        return data_ == nullptr || ::msync(data_, size_, MS_SYNC) == 0;
+    }
+
+  private:
+    MappedFile(void* data, size_t size) : data_(data), size_(size) {}
+
+    // the mapping outlives the descriptor; an empty file gets no mapping, as mmap rejects zero lengths
+    static auto Map(int fd, size_t size, int protection) -> std::optional<MappedFile> {
+        void* data = nullptr;
+        if (size > 0) {
+            data = ::mmap(nullptr, size, protection, MAP_SHARED, fd, 0);
+            if (data == MAP_FAILED) {
+                ::close(fd);
+                return std::nullopt;
+            }
+        }
+        ::close(fd);
+        return MappedFile(data, size);
+    }
+
+    void* data_ = nullptr;
+    size_t size_ = 0;
+};
+
+}
+
+#endif //PBSL_MAPPED_FILE_HPP
@@ -0,0 +1,44 @@
+#ifndef PBSL_MERGE_SCRATCH_HPP
+#define PBSL_MERGE_SCRATCH_HPP
+
+#include <algorithm>
+
+#include <parlay/primitives.h>
+#include <parlay/sequence.h>
+
+#include "util.hpp"
+#include "node.hpp"
+
+namespace pbsl {
+
+// Bookkeeping of one batch merge. It is stored densely by batch position rather than in the nodes,
+// and it is freed in bulk once the batch is linked in.
+// Entry (i, level) exists for every level below both the height of the i-th batch node and `levels`.
+template<typename Node>
+class MergeScratch {
+  public:
+    template<typename T> using Seq = util::types::Seq<T>;
+
+    struct Entry {
+        // previous batch node on this level
+        Node* prev = nullptr;
+        Node* new_prev = nullptr;
+        Node* new_next = nullptr;
+    };
+
+    MergeScratch(Seq<Node*> const& nodes, size_t levels)
+            : offsets_(parlay::map(nodes, [&](Node const* node) { return std::min(node->Height(), levels); })) {
+        size_t total = parlay::scan_inplace(offsets_);
+        entries_ = Seq<Entry>(total);
+    }
+
+    auto At(size_t i, size_t level) -> Entry& { return entries_[offsets_[i] + level]; }
+
+  private:
+    Seq<size_t> offsets_;
+    Seq<Entry> entries_;
+};
+
+}
+
+#endif //PBSL_MERGE_SCRATCH_HPP
@@ -1,80 +1,217 @@
 #ifndef PBSL_NODE_HPP
 #define PBSL_NODE_HPP
 
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <utility>
+
 #include <parlay/alloc.h>
 
 #include "util.hpp"
+#include "aggregate.hpp"
 #include "common/debug.hpp"
 
 namespace pbsl {
 
-struct Node {
-    using K = config::Key;
-    template<typename T> using Seq = util::types::Seq<T>;
+// Value type of skip lists that store keys only.
+struct NoValue {};
+
+// A node and its tower of links are stored in a single allocation: the links follow the node in memory.
+// Nodes are created and destroyed only through NodeAllocator.
+template<typename K, typename V, typename A = NoAggregate>
+struct alignas(alignof(void*)) Node {
+    struct Level {
+        Node* next = nullptr;
+        // number of nodes on level 0 from this node (inclusive) to next (exclusive)
+        size_t span = 1;
+        // A over the same nodes; left unused on level 0, where it is the node's own
+        [[no_unique_address]] typename A::Type aggregate = A::Identity();
+    };
+
+    enum Flags : uint8_t {
+        kRegular = 0,
+        kLeftSentinel = 1,
+        kRightSentinel = 2,
+    };
 
     // -----------------
 
     K const key;
-    Seq<Node*> next;
-
-    // auxiliary -------
-
-    Seq<size_t> subtree_size;
-    Seq<K> prev_key;
-    Seq<Node*> new_prev;
-    Seq<Node*> new_next;
+    [[no_unique_address]] V value;
 
     // -----------------
 
-    Node(K key, size_t height)
-            : key(key)
-            , next(height, nullptr)
-            , subtree_size(height, 0)
-            , prev_key(height, 0)
-            , new_prev(height, nullptr)
-            , new_next(height, nullptr)
+    Node(size_t height, size_t capacity, Flags flags, K key, V value = V{})
+            : key(std::move(key))
+            , value(std::move(value))
+            , height_(static_cast<uint8_t>(height))
+            , capacity_(static_cast<uint8_t>(capacity))
+            , flags_(flags)
             {
-        assert(height > 0);
+        assert(height > 0 && height <= capacity && capacity <= config::max_height);
+        std::uninitialized_fill_n(Levels(), capacity, Level{});
     }
 
-    auto Height() const -> size_t { return next.size(); }
+    // the tower is constructed along with the node, so it is destroyed with it as well
+    ~Node() { std::destroy_n(Levels(), capacity_); }
+
+    Node(Node const&) = delete;
+    auto operator=(Node const&) -> Node& = delete;
 
-    auto Next(size_t level) const -> Node* {
+    auto Height() const -> size_t { return height_; }
+
+    // number of levels the allocation has room for; greater than Height() only for sentinels
+    auto Capacity() const -> size_t { return capacity_; }
+
+    auto At(size_t level) -> Level& {
         assert(level < Height());
-        return next[level];
+        return Levels()[level];
+    }
+
+    auto At(size_t level) const -> Level const& {
+        assert(level < Height());
+        return Levels()[level];
+    }
+
+    auto Next(size_t level) const -> Node* { return At(level).next; }
+
+    // for readers that run concurrently with PublishNext
+    auto LoadNext(size_t level) const -> Node* {
+        // skips the assertion in At, as the height of a sentinel may grow concurrently
+        return std::atomic_ref<Node*>(const_cast<Node*&>(Levels()[level].next)).load(std::memory_order_acquire);
+    }
+
+    // links the node to next so that a concurrent reader that follows the link sees all writes made to next
+    // before, in particular its own links
+    auto PublishNext(size_t level, Node* next) -> void {
+        std::atomic_ref<Node*>(At(level).next).store(next, std::memory_order_release);
     }
 
-    // TODO: store an explicit flag?
-    auto IsSentinel() const -> bool { return IsLeftSentinel() || IsRightSentinel(); }
+    // the batch that inserted the node, see SkipList::Snapshot
+    auto Version() const -> uint32_t { return version_; }
+
+    auto SetVersion(uint32_t version) -> void { version_ = version; }
 
-    auto IsLeftSentinel() const -> bool { return key == util::Constants::MIN_KEY; }
+    auto IsSentinel() const -> bool { return flags_ != kRegular; }
 
-    auto IsRightSentinel() const -> bool { return key == util::Constants::MAX_KEY; }
+    auto IsLeftSentinel() const -> bool { return flags_ == kLeftSentinel; }
+
+    auto IsRightSentinel() const -> bool { return flags_ == kRightSentinel; }
 
     auto Resize(size_t height, Node* right) -> void {
-        next.resize(height, right);
-        subtree_size.resize(height, 0);
-    }
-
-//    auto TraverseRightAndGetLastNode() const -> Node* {
-//        return right_link_ == nullptr ? this : right_link_->TraverseRightAndGetLastNode();
-//    }
-
-    // expected complexity should be O(1), not sure about reality;
-    // normally, we shouldn't need to call this function for the last node in a layer;
-    //
-    // TODO: for each layer in skip list, store a flag indicating whether the layer has been changed,
-    //  and if not, use cached distance
-//    size_t CalcDistanceToNearestNodeWithParent() {
-//        assert(right_link_ != nullptr);
-//        size_t dist = 1;
-//        auto node = right_link_;
-//        while (!node->has_parent_) {
-//            ++dist;
-//            node = right_link_;
-//        }
-//        return dist;
-//    }
+        assert(height > 0 && height <= Capacity());
+        for (size_t level = Height(); level < height; ++level) {
+            Levels()[level] = Level{.next = right};
+        }
+        height_ = static_cast<uint8_t>(height);
+    }
+
+    static constexpr auto AllocationSize(size_t capacity) -> size_t { return sizeof(Node) + capacity * sizeof(Level); }
+
+  private:
+    auto Levels() -> Level* { return reinterpret_cast<Level*>(this + 1); }
+
+    auto Levels() const -> Level const* { return reinterpret_cast<Level const*>(this + 1); }
+
+    static_assert(config::max_height <= UINT8_MAX);
+
+    // heights are at most config::max_height, so the header fits in the padding after an 8-byte key
+    uint8_t height_;
+    uint8_t capacity_;
+    Flags flags_;
+    uint32_t version_ = 0;
+};
+
+// Nodes are pooled by capacity: each capacity has its own parlay::type_allocator over a storage type of the
+// right size, so a node with its whole tower is a single fixed-size block.
+template<typename NodeT>
+class NodeAllocator {
+    static_assert(sizeof(NodeT) % alignof(typename NodeT::Level) == 0);
+
+  public:
+    template<typename... Args>
+    static auto Create(size_t height, Args&&... args) -> NodeT* {
+        return new(Allocate(height)) NodeT(height, height, NodeT::kRegular, std::forward<Args>(args)...);
+    }
+
+    // sentinels get room for the maximum height, so that they can grow and shrink in place
+    template<typename... Args>
+    static auto CreateSentinel(size_t height, typename NodeT::Flags flags, Args&&... args) -> NodeT* {
+        return new(Allocate(config::max_height)) NodeT(height, config::max_height, flags, std::forward<Args>(args)...);
+    }
+
+    static auto Destroy(NodeT* node) -> void {
+        size_t capacity = node->Capacity();
+        node->~NodeT();
+        Frees()[capacity - 1](node);
+    }
+
+    // grows the pool of the given capacity to hold at least `count` nodes. Destroyed nodes go back to their
+    // pools as well, so later allocations reuse them instead of asking the system allocator for memory
+    static auto Reserve(size_t capacity, size_t count) -> void {
+        assert(capacity > 0 && capacity <= config::max_height);
+        Reserves()[capacity - 1](count);
+    }
+
+  private:
+    template<size_t kCapacity>
+    struct alignas(NodeT) alignas(typename NodeT::Level) Storage {
+        std::byte bytes[NodeT::AllocationSize(kCapacity)];
+    };
+
+    using Alloc = void* (*)();
+    using Free = void (*)(void*);
+    using ReserveFn = void (*)(size_t);
+
+    static auto Allocate(size_t capacity) -> void* {
+        assert(capacity > 0 && capacity <= config::max_height);
+        return Allocs()[capacity - 1]();
+    }
+
+    template<size_t kCapacity>
+    static auto AllocImpl() -> void* { return parlay::type_allocator<Storage<kCapacity>>::alloc(); }
+
+    template<size_t kCapacity>
+    static auto FreeImpl(void* ptr) -> void {
+        parlay::type_allocator<Storage<kCapacity>>::free(static_cast<Storage<kCapacity>*>(ptr));
+    }
+
+    template<size_t kCapacity>
+    static auto ReserveImpl(size_t count) -> void { parlay::type_allocator<Storage<kCapacity>>::reserve(count); }
+
+    template<size_t... Is>
+    static constexpr auto MakeAllocs(std::index_sequence<Is...>) -> std::array<Alloc, sizeof...(Is)> {
+        return {&AllocImpl<Is + 1>...};
+    }
+
+    template<size_t... Is>
+    static constexpr auto MakeFrees(std::index_sequence<Is...>) -> std::array<Free, sizeof...(Is)> {
+        return {&FreeImpl<Is + 1>...};
+    }
+
+    template<size_t... Is>
+    static constexpr auto MakeReserves(std::index_sequence<Is...>) -> std::array<ReserveFn, sizeof...(Is)> {
+        return {&ReserveImpl<Is + 1>...};
+    }
+
+    static auto Allocs() -> std::array<Alloc, config::max_height> const& {
+        static constexpr auto allocs = MakeAllocs(std::make_index_sequence<config::max_height>());
+        return allocs;
+    }
+
+    static auto Frees() -> std::array<Free, config::max_height> const& {
+        static constexpr auto frees = MakeFrees(std::make_index_sequence<config::max_height>());
+        return frees;
+    }
+
+    static auto Reserves() -> std::array<ReserveFn, config::max_height> const& {
+        static constexpr auto reserves = MakeReserves(std::make_index_sequence<config::max_height>());
+        return reserves;
+    }
 };
 
 }
@@ -0,0 +1,211 @@
+#ifndef PBSL_SHARDED_SKIP_LIST_HPP
+#define PBSL_SHARDED_SKIP_LIST_HPP
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <functional>
+#include <span>
+#include <utility>
+#include <vector>
+
+#include <parlay/parallel.h>
+#include <parlay/primitives.h>
+#include <parlay/sequence.h>
+
+#include "config.hpp"
+#include "util.hpp"
+#include "skip_list.hpp"
+
+namespace pbsl {
+
+// An ordered map range-partitioned into independent SkipLists: shard i holds the keys in [bounds[i - 1], bounds[i]).
+// A sorted batch is cut at the bounds with binary searches and merged into all shards in parallel, so every merge
+// touches only the sentinels and the nodes of its own shard. Nodes come from NodeAllocator, whose pools are
+// per worker, so the nodes of a shard stay with the workers that merged them.
+// Once the largest shard outgrows kMaxSkew times the average, the shards are joined and split again
+// at evenly spaced ranks, which costs O(shards * log n).
+template<typename K = config::Key, typename V = NoValue, typename Compare = std::less<K>>
+class ShardedSkipList {
+  public:
+    using Key = K;
+    using Value = V;
+    using Shard = SkipList<Key, Value, Compare>;
+    using Entry = typename Shard::Entry;
+    template<typename T> using Seq = util::types::Seq<T>;
+
+    static constexpr size_t kDefaultShardCount = 16;
+    static constexpr size_t kMaxSkew = 2;
+    // fewer keys per shard are not worth moving around
+    static constexpr size_t kMinRebalanceSize = 1 << 12;
+
+    // keys must be sorted and unique; they are split evenly among the shards
+    static auto FromOrderedKeys(Seq<Key> const& keys, size_t n_shards = kDefaultShardCount) -> ShardedSkipList {
+        return FromOrdered(keys, n_shards, [](Seq<Key> const& part) { return Shard::FromOrderedKeys(part); });
+    }
+
+    static auto FromOrderedEntries(Seq<Entry> const& entries, size_t n_shards = kDefaultShardCount)
+            -> ShardedSkipList {
+        return FromOrdered(entries, n_shards, [](Seq<Entry> const& part) { return Shard::FromOrderedEntries(part); });
+    }
+
+    // keys must be sorted, unique and not present in the list
+    auto InsertOrdered(Seq<Key> const& keys) -> void {
+        ForEachPart(keys, [](Shard& shard, Seq<Key> const& part) { shard.InsertOrdered(part); });
+        RebalanceIfSkewed();
+    }
+
+    auto InsertOrdered(Seq<Entry> const& entries) -> void {
+        ForEachPart(entries, [](Shard& shard, Seq<Entry> const& part) { shard.InsertOrdered(part); });
+        RebalanceIfSkewed();
+    }
+
+    // keys may come in any order and contain duplicates and keys that are already present
+    auto Insert(Seq<Key> keys) -> void {
+        parlay::sort_inplace(keys, Compare{});
+        ForEachPart(keys, [](Shard& shard, Seq<Key> const& part) { shard.Insert(part); });
+        RebalanceIfSkewed();
+    }
+
+    // of entries with equal keys, the first one in the batch is inserted; present keys keep their values
+    auto Insert(Seq<Entry> entries) -> void {
+        parlay::stable_sort_inplace(entries, [](Entry const& lhs, Entry const& rhs) {
+            return Shard::Less(lhs.first, rhs.first);
+        });
+        ForEachPart(entries, [](Shard& shard, Seq<Entry> const& part) { shard.Insert(part); });
+        RebalanceIfSkewed();
+    }
+
+    // keys must be sorted and unique; keys that are not present are ignored
+    auto EraseOrdered(Seq<Key> const& keys) -> void {
+        ForEachPart(keys, [](Shard& shard, Seq<Key> const& part) { shard.EraseOrdered(part); });
+        RebalanceIfSkewed();
+    }
+
+    // whether each key is present; the keys may come in any order. The indices of the keys are grouped by shard
+    // with one integer sort, and each shard looks up its own slice of them
+    auto Contains(std::span<Key const> keys) const -> Seq<bool> {
+        auto shard_of = parlay::map(keys, [&](Key const& key) { return ShardOf(key); });
+        auto indices = parlay::integer_sort(parlay::iota(keys.size()), [&](size_t i) { return shard_of[i]; });
+        auto offsets = parlay::tabulate(shards_.size() + 1, [&](size_t s) {
+            return static_cast<size_t>(std::partition_point(indices.begin(), indices.end(), [&](size_t i) {
+                return shard_of[i] < s;
+            }) - indices.begin());
+        });
+        auto result = Seq<bool>::uninitialized(keys.size());
+        parlay::parallel_for(0, shards_.size(), [&](size_t s) {
+            if (offsets[s] == offsets[s + 1]) return;
+            auto part = parlay::map(indices.cut(offsets[s], offsets[s + 1]), [&](size_t i) { return keys[i]; });
+            auto found = shards_[s].Contains(part);
+            parlay::parallel_for(0, part.size(), [&](size_t i) { result[indices[offsets[s] + i]] = found[i]; });
+        }, 1);
+        return result;
+    }
+
+    auto Size() const -> size_t {
+        return parlay::reduce(parlay::map(shards_, [](Shard const& shard) { return shard.Size(); }));
+    }
+
+    auto IsEmpty() const -> bool {
+        return std::all_of(shards_.begin(), shards_.end(), [](Shard const& shard) { return shard.IsEmpty(); });
+    }
+
+    auto ShardCount() const -> size_t { return shards_.size(); }
+
+    auto GetShard(size_t i) const -> Shard const& { return shards_[i]; }
+
+    // all keys in order
+    auto ToSequence() const -> Seq<Key> {
+        auto sizes = parlay::map(shards_, [](Shard const& shard) { return shard.Size(); });
+        size_t total = parlay::scan_inplace(sizes);
+        Seq<Key> keys(total);
+        parlay::parallel_for(0, shards_.size(), [&](size_t s) { shards_[s].CopyTo(keys.begin() + sizes[s]); }, 1);
+        return keys;
+    }
+
+    // calls f(key) or f(key, value) for every key, in parallel and in no particular order
+    template<typename F>
+    auto ForEach(F&& f) const -> void {
+        parlay::parallel_for(0, shards_.size(), [&](size_t s) { shards_[s].ForEach(f); }, 1);
+    }
+
+    // moves the bounds to evenly spaced ranks: all shards are joined into one list, which is then split
+    // at the new bounds from the right
+    auto Rebalance() -> void {
+        size_t n_shards = shards_.size();
+        Shard list = std::move(shards_[0]);
+        for (size_t s = 1; s < n_shards; ++s) list = Shard::Join(std::move(list), std::move(shards_[s]));
+        size_t size = list.Size();
+        if (size > 0) {
+            bounds_ = parlay::tabulate(n_shards - 1, [&](size_t s) { return list.SelectAt(size * (s + 1) / n_shards); });
+        }
+        for (size_t s = n_shards - 1; s > 0; --s) {
+            auto [left, right] = std::move(list).Split(bounds_[s - 1]);
+            shards_[s] = std::move(right);
+            list = std::move(left);
+        }
+        shards_[0] = std::move(list);
+    }
+
+  private:
+    ShardedSkipList(std::vector<Shard> shards, Seq<Key> bounds)
+        : shards_(std::move(shards))
+        , bounds_(std::move(bounds)) {
+        assert(!shards_.empty() && bounds_.size() + 1 == shards_.size());
+    }
+
+    static auto KeyOf(Key const& key) -> Key const& { return key; }
+
+    static auto KeyOf(Entry const& entry) -> Key const& { return entry.first; }
+
+    template<typename T, typename Build>
+    static auto FromOrdered(Seq<T> const& items, size_t n_shards, Build build) -> ShardedSkipList {
+        assert(!items.empty() && n_shards > 0);
+        auto bounds = parlay::tabulate(n_shards - 1, [&](size_t s) {
+            return KeyOf(items[items.size() * (s + 1) / n_shards]);
+        });
+        std::vector<Shard> shards;
+        shards.reserve(n_shards);
+        for (size_t s = 0; s < n_shards; ++s) shards.push_back(Shard::Empty());
+        parlay::parallel_for(0, n_shards, [&](size_t s) {
+            size_t begin = items.size() * s / n_shards;
+            size_t end = items.size() * (s + 1) / n_shards;
+            if (begin < end) shards[s] = build(parlay::to_sequence(items.cut(begin, end)));
+        }, 1);
+        return ShardedSkipList(std::move(shards), std::move(bounds));
+    }
+
+    // the shard whose range holds the key
+    auto ShardOf(Key const& key) const -> size_t {
+        return static_cast<size_t>(std::upper_bound(bounds_.begin(), bounds_.end(), key, Compare{}) - bounds_.begin());
+    }
+
+    // cuts the sorted items at the bounds and calls f(shard, part) for every shard with a nonempty part, in parallel
+    template<typename T, typename F>
+    auto ForEachPart(Seq<T> const& items, F&& f) -> void {
+        auto offsets = parlay::tabulate(shards_.size() + 1, [&](size_t s) -> size_t {
+            if (s == 0) return 0;
+            if (s == shards_.size()) return items.size();
+            return static_cast<size_t>(std::lower_bound(items.begin(), items.end(), bounds_[s - 1],
+                    [&](T const& item, Key const& bound) { return Shard::Less(KeyOf(item), bound); }) - items.begin());
+        });
+        parlay::parallel_for(0, shards_.size(), [&](size_t s) {
+            if (offsets[s] < offsets[s + 1]) f(shards_[s], parlay::to_sequence(items.cut(offsets[s], offsets[s + 1])));
+        }, 1);
+    }
+
+    auto RebalanceIfSkewed() -> void {
+        auto sizes = parlay::map(shards_, [](Shard const& shard) { return shard.Size(); });
+        size_t total = parlay::reduce(sizes);
+        if (total < kMinRebalanceSize * shards_.size()) return;
+        if (*parlay::max_element(sizes) * shards_.size() > kMaxSkew * total) Rebalance();
+    }
+
+    std::vector<Shard> shards_;
+    // bounds_[i] is the smallest key that may go to shard i + 1
+    Seq<Key> bounds_;
+};
+
+}
+
+#endif //PBSL_SHARDED_SKIP_LIST_HPP
@@ -1,10 +1,23 @@
 #ifndef PBSL_SKIP_LIST_HPP
 #define PBSL_SKIP_LIST_HPP
 
+#include <array>
+#include <atomic>
+#include <bit>
 #include <cinttypes>
 #include <climits>
 #include <concepts>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <optional>
+#include <span>
+#include <string>
+#include <tuple>
+#include <type_traits>
 #include <utility>
+#include <vector>
 
 #include <parlay/parallel.h>
 #include <parlay/primitives.h>
@@ -12,43 +25,557 @@
 
 #include "config.hpp"
 #include "util.hpp"
+#include "aggregate.hpp"
 #include "node.hpp"
+#include "merge_scratch.hpp"
+#include "stats.hpp"
+#include "mapped_file.hpp"
+#include "frozen_index.hpp"
 #include "common/util.hpp"
 
 namespace pbsl {
 
+// An ordered map from keys to values; with the default NoValue, an ordered set of keys.
+// Compare must be a stateless strict weak order. Keys and values are stored inline in the nodes,
+// and the sentinels are marked structurally, so every value of Key can be stored.
+// With an Aggregate A other than NoAggregate, every link also holds A over the nodes it skips, see RangeAggregate.
+template<typename K = config::Key, typename V = NoValue, typename Compare = std::less<K>, typename A = NoAggregate>
+    requires Aggregate<A, K, V>
 class SkipList {
   public:
-    using Key = size_t;
+    using Key = K;
+    using Value = V;
+    using Entry = std::pair<Key, Value>;
+    using AggregateType = typename A::Type;
+    using Node = pbsl::Node<Key, Value, A>;
+    using NodeAllocator = pbsl::NodeAllocator<Node>;
+    using FrozenIndex = pbsl::FrozenIndex<Key, Value, Compare>;
     template<typename T> using Seq = util::types::Seq<T>;
-    using NodeAllocator = parlay::type_allocator<Node>;
+
+    static constexpr bool kHasValues = !std::is_same_v<Value, NoValue>;
+    static constexpr bool kHasAggregate = !std::is_same_v<A, NoAggregate>;
+    // Save and Load copy keys and values bytewise
+    static constexpr bool kSerializable = std::is_trivially_copyable_v<Key>
+                                          && (!kHasValues || std::is_trivially_copyable_v<Value>);
+
+    struct FindResult {
+        bool found;
+        std::optional<Key> predecessor;  // largest key less than the query
+        std::optional<Key> successor;    // smallest key greater than the query
+        Value const* value;              // value stored with the query key, nullptr if it is absent
+    };
 
     static auto FromOrderedKeys(Seq<Key> const& keys) -> SkipList {
         assert(!keys.empty());
-        auto nodes = CreateNodes(keys, true).first;
-        return {nodes.front(), nodes.back()};
+        SkipListStats stats;
+        uint64_t salt = NewHeightSalt();
+        auto nodes = CreateNodes(keys.size(), [&](size_t i, size_t height) {
+            return CreateNode(height, keys[i]);
+        }, salt, 0, stats, true).first;
+        SkipList list(nodes.front(), nodes.back());
+        list.height_salt_ = salt;
+        list.n_heights_ = keys.size();
+        list.stats_ = stats;
+        return list;
+    }
+
+    static auto FromOrderedEntries(Seq<Entry> const& entries) -> SkipList {
+        assert(!entries.empty());
+        SkipListStats stats;
+        uint64_t salt = NewHeightSalt();
+        auto nodes = CreateNodes(entries.size(), [&](size_t i, size_t height) {
+            return CreateNode(height, entries[i].first, entries[i].second);
+        }, salt, 0, stats, true).first;
+        SkipList list(nodes.front(), nodes.back());
+        list.height_salt_ = salt;
+        list.n_heights_ = entries.size();
+        list.stats_ = stats;
+        return list;
+    }
+
+    // a list without keys, e.g. a shard that has none yet
+    static auto Empty() -> SkipList {
+        auto [left_sentinel, right_sentinel] = CreateSentinels(1);
+        left_sentinel->At(0) = {.next = right_sentinel, .span = 1};
+        return SkipList(left_sentinel, right_sentinel);
+    }
+
+    // a moved-from list may only be destroyed or assigned to
+    SkipList(SkipList&& other) noexcept
+        : left_sentinel_(std::exchange(other.left_sentinel_, nullptr))
+        , right_sentinel_(std::exchange(other.right_sentinel_, nullptr))
+        , cached_layer_(std::move(other.cached_layer_))
+        , cached_level_(other.cached_level_)
+        , height_salt_(other.height_salt_)
+        , n_heights_(other.n_heights_)
+        , version_(other.version_)
+        , published_(other.published_.load())
+        , stats_(other.stats_) {
+        other.InvalidateCachedLayer();
+    }
+
+    auto operator=(SkipList&& other) noexcept -> SkipList& {
+        std::swap(left_sentinel_, other.left_sentinel_);
+        std::swap(right_sentinel_, other.right_sentinel_);
+        std::swap(cached_layer_, other.cached_layer_);
+        std::swap(cached_level_, other.cached_level_);
+        std::swap(height_salt_, other.height_salt_);
+        std::swap(n_heights_, other.n_heights_);
+        std::swap(version_, other.version_);
+        published_.store(other.published_.exchange(published_.load()));
+        std::swap(stats_, other.stats_);
+        return *this;
     }
 
     ~SkipList() {
-        if (Height() == 0) {
-            NodeAllocator::destroy(left_sentinel_);
-            NodeAllocator::destroy(right_sentinel_);
-            return;
+        if (left_sentinel_ == nullptr) return;
+        DestroyNodes();
+        NodeAllocator::Destroy(left_sentinel_);
+        NodeAllocator::Destroy(right_sentinel_);
+    }
+
+    // removes all keys; the freed nodes stay in NodeAllocator's pools for later insertions
+    auto Clear() -> void {
+        DestroyNodes();
+        ResetSentinels();
+    }
+
+    // moves all nodes of other into this list, leaving other empty; the nodes are relinked rather than
+    // reallocated, and those with keys already present here are destroyed, so this list keeps its values
+    auto Union(SkipList&& other) -> void {
+        auto nodes = parlay::filter(other.GetLayer(0), [](Node const* node) { return !node->IsSentinel(); });
+        other.ResetSentinels();
+        if (nodes.empty()) return;
+        auto keys = parlay::map(nodes, [](Node const* node) { return node->key; });
+        auto preds = FindPredecessorsOrdered(keys);
+        auto is_new = parlay::tabulate(nodes.size(), [&](size_t i) { return !Holds(preds[i]->Next(0), keys[i]); });
+        parlay::parallel_for(0, nodes.size(), [&](size_t i) {
+            if (!is_new[i]) NodeAllocator::Destroy(nodes[i]);
+        });
+        nodes = parlay::pack(nodes, is_new);
+        if (nodes.empty()) return;
+        // Merge expects the batch to be linked among itself, with the last node of each level linking nowhere
+        parlay::parallel_for(0, nodes.size(), [&](size_t i) {
+            for (size_t level = 0; level < nodes[i]->Height(); ++level) nodes[i]->At(level) = {};
+        });
+        size_t height = (*parlay::max_element(nodes, [](Node const* lhs, Node const* rhs) {
+            return lhs->Height() < rhs->Height();
+        }))->Height();
+        LinkNodes(nodes, height);
+        Merge(nodes, height);
+    }
+
+    // splits the list into the keys smaller than `key` and the rest in O(log n) expected time
+    auto Split(Key const& key) && -> std::pair<SkipList, SkipList> {
+        size_t height = Height();
+        // the left sentinel of the second part and the right sentinel of the first one
+        auto [right_begin, left_end] = CreateSentinels(height);
+        // preds[level] is the last node on `level` with a smaller key, and positions[level] is its position,
+        // counting the left sentinel as 0
+        std::array<Node*, config::max_height> preds;
+        std::array<size_t, config::max_height> positions;
+        Node* node = left_sentinel_;
+        size_t position = 0;
+        for (size_t level = height; level-- > 0;) {
+            while (Precedes(node->Next(level), key)) {
+                position += node->At(level).span;
+                node = node->Next(level);
+            }
+            preds[level] = node;
+            positions[level] = position;
+        }
+        for (size_t level = 0; level < height; ++level) {
+            auto& link = preds[level]->At(level);
+            right_begin->At(level) = {.next = link.next, .span = positions[level] + link.span - position};
+            link = {.next = left_end, .span = position + 1 - positions[level]};
+        }
+        if constexpr (kHasAggregate) {
+            for (size_t level = 1; level < height; ++level) {
+                RecomputeSpan(preds[level], level);
+                RecomputeSpan(right_begin, level);
+            }
+        }
+        InvalidateCachedLayer();
+        SkipList left(std::exchange(left_sentinel_, nullptr), left_end);
+        SkipList right(right_begin, std::exchange(right_sentinel_, nullptr));
+        left.n_heights_ = right.n_heights_ = n_heights_;
+        // both parts hold nodes of every version so far, so snapshots must see them all
+        left.version_ = right.version_ = version_;
+        left.Publish();
+        right.Publish();
+        left.ShrinkHeight();
+        right.ShrinkHeight();
+        return {std::move(left), std::move(right)};
+    }
+
+    // concatenates two lists in O(log n) expected time; all keys of left must be smaller than those of right
+    static auto Join(SkipList&& left, SkipList&& right) -> SkipList {
+        size_t height = std::max(left.Height(), right.Height());
+        left.CoerceHeightAtLeast(height);
+        right.CoerceHeightAtLeast(height);
+        assert(left.IsEmpty() || right.IsEmpty()
+               || Less(left.SelectAt(left.Size() - 1), right.left_sentinel_->Next(0)->key));
+        // on each level, the last node of left is linked to the first node of right,
+        // and both the right sentinel of left and the left sentinel of right drop out of its span
+        Node* node = left.left_sentinel_;
+        for (size_t level = height; level-- > 0;) {
+            while (node->Next(level) != left.right_sentinel_) node = node->Next(level);
+            auto& link = node->At(level);
+            auto const& first = right.left_sentinel_->At(level);
+            link = {.next = first.next, .span = link.span - 1 + first.span,
+                    .aggregate = A::Combine(link.aggregate, first.aggregate)};
+        }
+        NodeAllocator::Destroy(std::exchange(left.right_sentinel_, nullptr));
+        NodeAllocator::Destroy(std::exchange(right.left_sentinel_, nullptr));
+        left.InvalidateCachedLayer();
+        right.InvalidateCachedLayer();
+        SkipList list(std::exchange(left.left_sentinel_, nullptr), std::exchange(right.right_sentinel_, nullptr));
+        list.n_heights_ = std::max(left.n_heights_, right.n_heights_);
+        // the newer of the two versions, so that the next merge gets a version no node has yet
+        list.version_ = static_cast<int32_t>(left.version_ - right.version_) > 0 ? left.version_ : right.version_;
+        list.Publish();
+        return list;
+    }
+
+    // preallocates nodes for `size` keys with the expected distribution of heights,
+    // e.g. ahead of FromOrderedKeys on a cold start
+    static auto ReserveNodes(size_t size) -> void {
+        double count = static_cast<double>(size) * config::p;
+        for (size_t height = 1; height < config::max_height && count >= 1; ++height, count *= 1 - config::p) {
+            NodeAllocator::Reserve(height, static_cast<size_t>(count));
+        }
+    }
+
+    // writes the keys, the values and the height of every node to `path` in the format read by Load;
+    // the sections are filled in parallel through a mapping of a temporary file, which is renamed once synced
+    // and removed if anything fails
+    auto Save(std::string const& path) const -> bool requires kSerializable {
+        size_t size = Size();
+        auto layout = GetFileLayout(size);
+        std::string temp_path = path + ".tmp";
+        // the file is unmapped once written, before it is renamed or removed
+        bool written = [&]() {
+            auto file = MappedFile::Create(temp_path, layout.end);
+            if (!file) return false;
+            std::byte* data = file->Data();
+            FileHeader header{.size = size, .n_heights = n_heights_};
+            std::memcpy(data, &header, sizeof(header));
+            auto keys = reinterpret_cast<Key*>(data + layout.keys);
+            auto values = reinterpret_cast<Value*>(data + layout.values);
+            auto heights = reinterpret_cast<uint8_t*>(data + layout.heights);
+            ForEachIndexed([&](size_t i, Node const* node) {
+                keys[i] = node->key;
+                if constexpr (kHasValues) values[i] = node->value;
+                heights[i] = static_cast<uint8_t>(node->Height());
+            });
+            return file->Sync();
+        }();
+        if (written && std::rename(temp_path.c_str(), path.c_str()) == 0) return true;
+        std::remove(temp_path.c_str());
+        return false;
+    }
+
+    // restores a list saved by Save with its original heights, so no heights are drawn and nothing is sorted:
+    // nodes are created straight from the mapped file and linked in parallel. Returns nothing if the file is
+    // missing, truncated, or was saved by a list with other key or value types
+    static auto Load(std::string const& path) -> std::optional<SkipList> requires kSerializable {
+        auto file = MappedFile::Open(path);
+        if (!file || file->Size() < sizeof(FileHeader)) return std::nullopt;
+        std::byte const* data = file->Data();
+        FileHeader header;
+        std::memcpy(&header, data, sizeof(header));
+        FileHeader const expected;
+        if (header.magic != expected.magic || header.format_version != expected.format_version
+            || header.key_size != expected.key_size || header.value_size != expected.value_size) {
+            return std::nullopt;
+        }
+        // every node takes at least a byte, which also keeps the layout from overflowing
+        if (header.size > file->Size()) return std::nullopt;
+        auto layout = GetFileLayout(header.size);
+        if (layout.end > file->Size()) return std::nullopt;
+        std::span<uint8_t const> heights(reinterpret_cast<uint8_t const*>(data + layout.heights), header.size);
+        if (!parlay::all_of(heights, [](uint8_t height) { return 1 <= height && height <= config::max_height; })) {
+            return std::nullopt;
         }
-        for (Node* node = left_sentinel_; node != nullptr;) {
-            Node* next = node->Next(0);
-            NodeAllocator::destroy(node);
-            node = next;
+        Node* left_sentinel = nullptr;
+        Node* right_sentinel = nullptr;
+        SkipListStats stats;
+        if (header.size == 0) {
+            std::tie(left_sentinel, right_sentinel) = CreateSentinels(1);
+            left_sentinel->At(0) = {.next = right_sentinel, .span = 1};
+        } else {
+            auto keys = reinterpret_cast<Key const*>(data + layout.keys);
+            auto values = reinterpret_cast<Value const*>(data + layout.values);
+            auto nodes = CreateNodesWithHeights(heights, [&](size_t i, size_t height) {
+                if constexpr (kHasValues) return CreateNode(height, keys[i], values[i]);
+                else return CreateNode(height, keys[i]);
+            }, stats, true).first;
+            left_sentinel = nodes.front();
+            right_sentinel = nodes.back();
         }
+        SkipList list(left_sentinel, right_sentinel);
+        // later insertions keep drawing heights where the saved list stopped
+        list.n_heights_ = header.n_heights;
+        list.stats_ = stats;
+        return list;
     }
 
+    // keys must be sorted, unique and not present in the list; see Insert otherwise
     auto InsertOrdered(Seq<Key> const& keys) -> void {
         assert(!keys.empty());
-        auto [nodes, height] = CreateNodes(keys, false);
-        //std::cout << "other height = " << height << std::endl;
+        if (keys.size() <= config::small_batch_size) {
+            return InsertSequentially(keys.size(), [&](size_t i, size_t height) { return CreateNode(height, keys[i]); });
+        }
+        auto [nodes, height] = CreateNodes(keys.size(), [&](size_t i, size_t height) {
+            return CreateNode(height, keys[i]);
+        }, height_salt_, DrawHeightIndices(keys.size()), stats_);
+        Merge(nodes, height);
+    }
+
+    auto InsertOrdered(Seq<Entry> const& entries) -> void {
+        assert(!entries.empty());
+        if (entries.size() <= config::small_batch_size) {
+            return InsertSequentially(entries.size(), [&](size_t i, size_t height) {
+                return CreateNode(height, entries[i].first, entries[i].second);
+            });
+        }
+        auto [nodes, height] = CreateNodes(entries.size(), [&](size_t i, size_t height) {
+            return CreateNode(height, entries[i].first, entries[i].second);
+        }, height_salt_, DrawHeightIndices(entries.size()), stats_);
         Merge(nodes, height);
     }
 
+    // keys may come in any order and contain duplicates and keys that are already present
+    auto Insert(Seq<Key> keys) -> void {
+        keys = FilterNewOrdered(std::move(keys), [](Key const& key) -> Key const& { return key; });
+        if (!keys.empty()) InsertOrdered(keys);
+    }
+
+    // of entries with equal keys, the first one in the batch is inserted; present keys keep their values
+    auto Insert(Seq<Entry> entries) -> void {
+        entries = FilterNewOrdered(std::move(entries), [](Entry const& entry) -> Key const& { return entry.first; });
+        if (!entries.empty()) InsertOrdered(entries);
+    }
+
+    // keys must be sorted and unique; keys that are not present are ignored
+    auto EraseOrdered(Seq<Key> const& keys) -> void {
+        assert(!keys.empty());
+        size_t height = std::min(Height(), ExpectedBatchHeight(keys.size()));
+        size_t crit_level = Height() - height;
+        auto crit_layer = GetLayer(crit_level);
+        auto starting_indices = FindStartingIndicesInCritLayer(crit_layer, keys);
+        // preds[i * crit_level + level] is the last node on `level` with a key smaller than keys[i]
+        auto preds = Seq<Node*>::uninitialized(keys.size() * crit_level);
+        auto targets = parlay::tabulate(keys.size(), [&](size_t i) {
+            return PrepareErase(crit_layer[starting_indices[i]], crit_level, keys[i], preds.begin() + i * crit_level);
+        });
+        auto is_erased = Seq<bool>(crit_layer.size(), false);
+        parlay::parallel_for(0, keys.size(), [&](size_t i) {
+            if (targets[i] != nullptr && targets[i]->Height() > crit_level) is_erased[starting_indices[i] + 1] = true;
+        });
+        auto nodes = parlay::filter(targets, [](Node* const node) { return node != nullptr; });
+        if (nodes.empty()) return;
+        auto survivors = parlay::pack(crit_layer, parlay::map(is_erased, std::logical_not<>()));
+        parlay::par_do(
+                [&]() { UnlinkHigherLevels(survivors, crit_level); },
+                [&]() { UnlinkLowerLevels(targets, preds, crit_level); }
+        );
+        // the cache may hold erased nodes; it is replaced by the survivors below unless the list got too low
+        InvalidateCachedLayer();
+        parlay::parallel_for(0, nodes.size(), [&](size_t i) { NodeAllocator::Destroy(nodes[i]); });
+        ShrinkHeight();
+        UpdateSpans(survivors, keys, crit_level);
+        if (crit_level < Height()) CacheLayer(std::move(survivors), crit_level);
+        Publish();
+    }
+
+    // erases every key for which pred(key), or pred(key, value), holds. The predicate is evaluated over level 0
+    // in parallel, and every level is relinked from the surviving nodes as in EraseOrdered above its critical level
+    template<typename Pred>
+    auto RemoveIf(Pred&& pred) -> void {
+        auto layer = GetLayer(0);
+        auto is_kept = parlay::map(layer, [&](Node* node) { return node->IsSentinel() || !Apply(pred, node); });
+        auto removed = parlay::pack(layer, parlay::map(is_kept, std::logical_not<>()));
+        if (removed.empty()) return;
+        auto survivors = parlay::pack(layer, is_kept);
+        size_t height = Height();
+        UnlinkHigherLevels(survivors, 0);
+        RecomputeSpans(survivors, height);
+        parlay::parallel_for(0, removed.size(), [&](size_t i) { NodeAllocator::Destroy(removed[i]); });
+        InvalidateCachedLayer();
+        ShrinkHeight();
+        Publish();
+    }
+
+    // erases the keys in [lo, hi) in O(log n + k) expected time for k erased keys. Only the links into the range
+    // change: on every level, the last node before lo is linked to the first node not smaller than hi
+    auto EraseRange(Key const& lo, Key const& hi) -> void {
+        if (!Less(lo, hi)) return;
+        size_t height = Height();
+        // preds[level] is the last node on `level` with a key smaller than lo, and succs[level] is the first one
+        // with a key not smaller than hi
+        std::array<Node*, config::max_height> preds;
+        std::array<Node*, config::max_height> succs;
+        Node* node = left_sentinel_;
+        Node* last = left_sentinel_;
+        for (size_t level = height; level-- > 0;) {
+            while (Precedes(node->Next(level), lo)) node = node->Next(level);
+            if (NodeLess(last, node)) last = node;
+            while (Precedes(last->Next(level), hi)) last = last->Next(level);
+            preds[level] = node;
+            succs[level] = last->Next(level);
+        }
+        Node* first = preds[0]->Next(0);
+        if (first == succs[0]) return;
+        // the erased nodes of level 0 are split into runs at the erased nodes of the run level, and freed in parallel
+        size_t run_level = RunLevel();
+        Seq<Node*> heads = {first};
+        for (Node* cur = preds[run_level]->Next(run_level); cur != succs[run_level]; cur = cur->Next(run_level)) {
+            if (cur != first) heads.push_back(cur);
+        }
+        for (size_t level = 0; level < height; ++level) preds[level]->PublishNext(level, succs[level]);
+        for (size_t level = 1; level < height; ++level) RecomputeSpan(preds[level], level);
+        parlay::parallel_for(0, heads.size(), [&](size_t i) {
+            Node* end = i + 1 < heads.size() ? heads[i + 1] : succs[0];
+            for (Node* cur = heads[i]; cur != end;) NodeAllocator::Destroy(std::exchange(cur, cur->Next(0)));
+        });
+        InvalidateCachedLayer();
+        ShrinkHeight();
+        Publish();
+    }
+
+    // keys must be sorted; queries that fall between the same pair of nodes in the critical layer
+    // start from the same node, so that a batch of size m costs O(m log(n/m)) work
+    auto FindOrdered(Seq<Key> const& keys) const -> Seq<FindResult> {
+        assert(!keys.empty());
+        auto preds = FindPredecessorsOrdered(keys);
+        return parlay::tabulate(keys.size(), [&](size_t i) {
+            Node* pred = preds[i];
+            Node* next = pred->Next(0);
+            Value const* value = nullptr;
+            bool found = Holds(next, keys[i]);
+            if (found) {
+                value = &next->value;
+                next = next->Next(0);
+            }
+            return FindResult{
+                    found,
+                    pred->IsLeftSentinel() ? std::nullopt : std::optional<Key>(pred->key),
+                    next->IsRightSentinel() ? std::nullopt : std::optional<Key>(next->key),
+                    value
+            };
+        });
+    }
+
+    // A consistent view of the keys as of the last completed update. Its lookups may run concurrently with
+    // InsertOrdered and Insert on the list, and do not see the keys inserted by them; no other update may run
+    // concurrently. The list must not be moved while the snapshot is in use
+    class Snapshot {
+      public:
+        // whether each key is present in the snapshot; the keys may come in any order
+        auto Contains(std::span<Key const> keys) const -> Seq<bool> {
+            return parlay::map(keys, [&](Key const& key) { return Find(key) != nullptr; });
+        }
+
+        // the value stored with the key, nullptr if it is absent from the snapshot
+        auto Find(Key const& key) const -> Value const* {
+            Node* node = left_sentinel_;
+            Node* next = nullptr;
+            for (size_t level = height_; level-- > 0;) {
+                next = NextInSnapshot(node, level);
+                while (Precedes(next, key)) {
+                    node = next;
+                    next = NextInSnapshot(node, level);
+                }
+            }
+            return Holds(next, key) ? &next->value : nullptr;
+        }
+
+        auto Version() const -> uint32_t { return version_; }
+
+      private:
+        friend class SkipList;
+
+        Snapshot(Node* left_sentinel, uint64_t published)
+            : left_sentinel_(left_sentinel)
+            , version_(static_cast<uint32_t>(published >> 8))
+            , height_(published & 0xff) {
+        }
+
+        // nodes of later batches are skipped; their links were set before they were published
+        auto NextInSnapshot(Node const* node, size_t level) const -> Node* {
+            Node* next = node->LoadNext(level);
+            // versions wrap around, so only their difference is compared
+            while (!next->IsSentinel() && static_cast<int32_t>(next->Version() - version_) > 0) {
+                next = next->LoadNext(level);
+            }
+            return next;
+        }
+
+        Node* left_sentinel_;
+        uint32_t version_;
+        size_t height_;
+    };
+
+    auto GetSnapshot() const -> Snapshot {
+        return {left_sentinel_, published_.load(std::memory_order_acquire)};
+    }
+
+    // whether each key is present; the keys may come in any order. Each worker interleaves the descents of
+    // several keys and prefetches the node that each descent reads next, so that their cache misses overlap
+    auto Contains(std::span<Key const> keys) const -> Seq<bool> {
+        return ContainsInGroups<kLookupGroupSize>(keys);
+    }
+
+    // number of keys smaller than each of the given keys
+    auto Rank(Seq<Key> const& keys) const -> Seq<size_t> {
+        return parlay::map(keys, [&](Key const& key) { return RankOf(key); });
+    }
+
+    // the keys at the given 0-based positions in sorted order; each index must be less than Size()
+    auto Select(Seq<size_t> const& indices) const -> Seq<Key> {
+        return parlay::map(indices, [&](size_t index) { return SelectAt(index); });
+    }
+
+    // number of keys in [lo, hi)
+    auto CountRange(Key const& lo, Key const& hi) const -> size_t {
+        if (!Less(lo, hi)) return 0;
+        size_t hi_rank = 0;
+        size_t lo_rank = 0;
+        parlay::par_do(
+                [&]() { hi_rank = RankOf(hi); },
+                [&]() { lo_rank = RankOf(lo); }
+        );
+        return hi_rank - lo_rank;
+    }
+
+    // A over the entries with keys in [lo, hi), in key order, in O(log n) expected time. The walk from lo
+    // climbs while a higher link still ends at a key not greater than hi, and descends once it would pass hi,
+    // as in finger search; each link taken contributes its stored aggregate
+    auto RangeAggregate(Key const& lo, Key const& hi) const -> AggregateType requires kHasAggregate {
+        AggregateType result = A::Identity();
+        if (!Less(lo, hi)) return result;
+        Node* node = FindPredecessor(left_sentinel_, Height() - 1, lo)->Next(0);
+        // whether all nodes before next have keys smaller than hi
+        auto ends_within = [&](Node const* next) { return !next->IsRightSentinel() && !Less(hi, next->key); };
+        size_t level = 0;
+        while (!node->IsRightSentinel() && Less(node->key, hi)) {
+            while (level + 1 < node->Height() && ends_within(node->Next(level + 1))) ++level;
+            while (level > 0 && !ends_within(node->Next(level))) --level;
+            result = A::Combine(result, LinkAggregate(node, level));
+            node = node->Next(level);
+        }
+        return result;
+    }
+
+    auto Size() const -> size_t {
+        size_t size = 0;
+        for (Node* node = left_sentinel_; node != right_sentinel_; node = node->Next(Height() - 1)) {
+            size += node->At(Height() - 1).span;
+        }
+        return size - 1;
+    }
+
 //    auto PrettyPrint(std::ostream& out) const -> void {
 //        size_t n = 0;
 //        size_t cell_len = 2;
@@ -75,6 +602,94 @@ class SkipList {
 
     auto IsEmpty() const -> bool { return Height() == 0 || left_sentinel_->Next(0) == right_sentinel_; }
 
+    // bytes taken by all nodes, sentinels included, not counting the allocator's own overhead
+    auto AllocatedBytes() const -> size_t {
+        auto layer = GetLayer(0);
+        return parlay::reduce(parlay::map(layer, [](Node const* node) { return Node::AllocationSize(node->Capacity()); }));
+    }
+
+    // all keys in order
+    auto ToSequence() const -> Seq<Key> {
+        Seq<Key> keys(Size());
+        CopyTo(keys.begin());
+        return keys;
+    }
+
+    // all entries in order
+    auto ToEntries() const -> Seq<Entry> requires kHasValues {
+        Seq<Entry> entries(Size());
+        ExportTo(entries.begin(), [](Node const* node) { return Entry(node->key, node->value); });
+        return entries;
+    }
+
+    // an immutable copy of the list that is searched without chasing pointers, for long read-only phases;
+    // later changes to the list do not affect it
+    auto Freeze() const -> FrozenIndex {
+        Seq<Key> keys(Size());
+        Seq<Value> values(kHasValues ? keys.size() : 0);
+        ForEachIndexed([&](size_t i, Node const* node) {
+            keys[i] = node->key;
+            if constexpr (kHasValues) values[i] = node->value;
+        });
+        return FrozenIndex(std::move(keys), std::move(values));
+    }
+
+    // writes all keys in order to out[0, Size()), e.g. to a buffer owned by the caller
+    template<typename It>
+    auto CopyTo(It out) const -> void {
+        ExportTo(out, [](Node const* node) -> Key const& { return node->key; });
+    }
+
+    // calls f(key) or f(key, value) for every key, in parallel and in no particular order
+    template<typename F>
+    auto ForEach(F&& f) const -> void {
+        size_t level = RunLevel();
+        ForEachInRuns(GetLayer(level), level, [&](size_t, Node* node) {
+            if (!node->IsSentinel()) Apply(f, node);
+        });
+    }
+
+    // same for the keys in [lo, hi); only the runs that overlap the range are visited
+    template<typename F>
+    auto ForEach(Key const& lo, Key const& hi, F&& f) const -> void {
+        if (!Less(lo, hi)) return;
+        size_t level = RunLevel();
+        ForEachInRuns(GetLayerInRange(level, lo, hi), level, [&](size_t, Node* node) {
+            if (InRange(node, lo, hi)) Apply(f, node);
+        });
+    }
+
+    // combines map(key) or map(key, value) over all keys in order; the monoid provides `identity` and
+    // an associative operator(), like parlay::plus<T>() or parlay::binary_op(f, identity)
+    template<typename F, typename Monoid>
+    auto Reduce(F&& map, Monoid monoid) const {
+        size_t level = RunLevel();
+        auto layer = GetLayer(level);
+        Seq<decltype(monoid.identity)> partials(layer.size(), monoid.identity);
+        ForEachInRuns(layer, level, [&](size_t i, Node* node) {
+            if (!node->IsSentinel()) partials[i] = monoid(partials[i], Apply(map, node));
+        });
+        return parlay::reduce(partials, monoid);
+    }
+
+    // same over the keys in [lo, hi)
+    template<typename F, typename Monoid>
+    auto Reduce(Key const& lo, Key const& hi, F&& map, Monoid monoid) const {
+        if (!Less(lo, hi)) return monoid.identity;
+        size_t level = RunLevel();
+        auto layer = GetLayerInRange(level, lo, hi);
+        Seq<decltype(monoid.identity)> partials(layer.size(), monoid.identity);
+        ForEachInRuns(layer, level, [&](size_t i, Node* node) {
+            if (InRange(node, lo, hi)) partials[i] = monoid(partials[i], Apply(map, node));
+        });
+        return parlay::reduce(partials, monoid);
+    }
+
+    // per-phase timings and counters of batch insertions and construction, see SkipListStats
+    auto GetStats() const -> SkipListStats const& { return stats_; }
+
+    auto ResetStats() -> void { stats_ = {}; }
+
     // debug
     auto DebugGetNodes(size_t level = 0) const -> std::vector<Node*> {
         std::vector<Node*> nodes;
@@ -85,109 +700,363 @@ class SkipList {
     }
 
   //private:
+    // keeps one node per block in a SkipList, whose searches it extends into the blocks
+    template<typename UK, typename UCompare, size_t kBlockBytes>
+        requires std::is_trivially_copyable_v<UK>
+    friend class UnrolledSkipList;
+
+    // cuts batches at its shard bounds with Less, and picks new bounds with SelectAt
+    template<typename, typename, typename>
+    friend class ShardedSkipList;
+
+    // sorts the buffered operations with Less
+    template<typename>
+    friend class BatchingWriter;
+
     SkipList(Node* left_sentinel, Node* right_sentinel)
         : left_sentinel_(left_sentinel)
         , right_sentinel_(right_sentinel) {
         assert(left_sentinel != nullptr && right_sentinel != nullptr);
+        Publish();
     }
 
-    static auto CreateNode(Key key) -> Node* { return NodeAllocator::create(key, GenerateHeight()); }
+    // the file written by Save: the header, the keys, the values unless Value is NoValue, and the height of every
+    // node as a byte, each section aligned for its type
+    struct FileHeader {
+        std::array<char, 4> magic = {'P', 'B', 'S', 'L'};
+        uint32_t format_version = 1;
+        uint32_t key_size = sizeof(Key);
+        uint32_t value_size = kHasValues ? sizeof(Value) : 0;
+        uint64_t size = 0;
+        uint64_t n_heights = 0;
+    };
 
-    static auto CreateNodes(Seq<Key> const& keys, bool sentinelled = false) -> std::pair<Seq<Node*>, size_t> {
-        auto nodes = parlay::map(keys, CreateNode);
-        size_t height = (*parlay::max_element(nodes, [](auto lhs, auto rhs) {
-            return lhs->Height() < rhs->Height();
-        }))->Height();
-        if (sentinelled) {
-            auto [left_sentinel, right_sentinel] = CreateSentinels(height);
-            // TODO: create array of n + 2 nodes right away (with sentinels at both ends),
-            //  then adjust the sentinels' heights
-            nodes.insert(nodes.begin(), left_sentinel);
-            nodes.push_back(right_sentinel);
-        }
-        auto layer = nodes;
-        for (size_t level = 0; level < height;) {
-            // TODO: FillLinks after this loop for all levels in parallel?
-            FillLinks(layer, level++);
-            layer = FilterNodesHigherThan(layer, level);
+    struct FileLayout {
+        size_t keys, values, heights, end;
+    };
+
+    static auto GetFileLayout(size_t size) -> FileLayout {
+        auto align = [](size_t offset, size_t alignment) { return (offset + alignment - 1) / alignment * alignment; };
+        FileLayout layout{};
+        layout.keys = align(sizeof(FileHeader), alignof(Key));
+        layout.values = align(layout.keys + size * sizeof(Key), alignof(Value));
+        layout.heights = layout.values + (kHasValues ? size * sizeof(Value) : 0);
+        layout.end = layout.heights + size;
+        return layout;
+    }
+
+    // makes the current version and height visible to new snapshots
+    auto Publish() -> void {
+        published_.store(static_cast<uint64_t>(version_) << 8 | Height(), std::memory_order_release);
+    }
+
+    using Traits = util::KeyTraits<Key, Compare>;
+
+    static auto Less(Key const& lhs, Key const& rhs) -> bool { return Compare{}(lhs, rhs); }
+
+    static auto Equal(Key const& lhs, Key const& rhs) -> bool { return !Less(lhs, rhs) && !Less(rhs, lhs); }
+
+    // whether the node, which must not be the left sentinel, goes before the key
+    static auto Precedes(Node const* node, Key const& key) -> bool {
+        if constexpr (Traits::kSentinelKeys) {
+            return node->key < key;
+        } else {
+            return !node->IsRightSentinel() && Less(node->key, key);
+        }
+    }
+
+    static auto Holds(Node const* node, Key const& key) -> bool { return !node->IsSentinel() && Equal(node->key, key); }
+
+    // order of nodes in the list, sentinels included
+    static auto NodeLess(Node const* lhs, Node const* rhs) -> bool {
+        if (lhs->IsSentinel() || rhs->IsSentinel()) {
+            return lhs != rhs && (lhs->IsLeftSentinel() || rhs->IsRightSentinel());
+        }
+        return Less(lhs->key, rhs->key);
+    }
+
+    // sorts the batch and leaves the first item for each key that is not present in the list
+    template<typename T, typename KeyOf>
+    auto FilterNewOrdered(Seq<T> items, KeyOf key_of) const -> Seq<T> {
+        if (items.empty()) return items;
+        parlay::stable_sort_inplace(items, [&](T const& lhs, T const& rhs) { return Less(key_of(lhs), key_of(rhs)); });
+        auto keys = parlay::map(items, [&](T const& item) { return key_of(item); });
+        auto preds = FindPredecessorsOrdered(keys);
+        auto is_new = parlay::tabulate(keys.size(), [&](size_t i) {
+            return (i == 0 || Less(keys[i - 1], keys[i])) && !Holds(preds[i]->Next(0), keys[i]);
+        });
+        return parlay::pack(items, is_new);
+    }
+
+    static auto CreateNode(size_t height, Key const& key, Value value = Value{}) -> Node* {
+        return NodeAllocator::Create(height, key, std::move(value));
+    }
+
+    // create(i, height) returns the i-th node, whose height is drawn for index first_index + i of the list
+    // with the salt; with sentinels, they are placed at both ends of the array right away
+    template<typename F>
+    static auto CreateNodes(size_t size, F&& create, uint64_t salt, uint64_t first_index, SkipListStats& stats,
+                            bool sentinelled = false) -> std::pair<Seq<Node*>, size_t> {
+        Seq<size_t> heights;
+        {
+            PhaseTimer timer(stats.create_nodes_ns);
+            heights = parlay::tabulate(size, [&](size_t i) { return GenerateHeight(salt, first_index + i); });
+        }
+        return CreateNodesWithHeights(heights, create, stats, sentinelled);
+    }
+
+    // same with the heights given, e.g. by a saved list; heights must not be empty
+    template<typename Heights, typename F>
+    static auto CreateNodesWithHeights(Heights const& heights, F&& create, SkipListStats& stats,
+                                       bool sentinelled = false) -> std::pair<Seq<Node*>, size_t> {
+        size_t size = heights.size();
+        size_t height = 0;
+        Seq<Node*> nodes;
+        {
+            PhaseTimer timer(stats.create_nodes_ns);
+            height = *parlay::max_element(heights);
+            size_t offset = sentinelled ? 1 : 0;
+            Node* left_sentinel = nullptr;
+            Node* right_sentinel = nullptr;
+            if (sentinelled) std::tie(left_sentinel, right_sentinel) = CreateSentinels(height);
+            nodes = parlay::tabulate(size + 2 * offset, [&](size_t i) {
+                if (sentinelled && i == 0) return left_sentinel;
+                if (sentinelled && i == size + 1) return right_sentinel;
+                return create(i - offset, static_cast<size_t>(heights[i - offset]));
+            });
+        }
+        if constexpr (config::StatsEnabled()) {
+            stats.nodes_created += size;
+            stats.bytes_allocated += parlay::reduce(parlay::map(nodes, [](Node const* node) {
+                return Node::AllocationSize(node->Capacity());
+            }));
+        }
+        {
+            PhaseTimer timer(stats.link_nodes_ns);
+            LinkNodes(nodes, height);
+            // a batch gets its aggregates once merged
+            if constexpr (kHasAggregate) {
+                if (sentinelled) RecomputeSpans(nodes, height);
+            }
         }
         return {nodes, height};
     }
 
+    static constexpr size_t kLinkBlockSize = 2048;
+
+    // links all levels of consecutive nodes and sets their spans in one pass over the array. Each block of
+    // nodes is linked sequentially, remembering its first and last node on every level; then, on every level,
+    // the last node of a block is linked to the first node of the next block that has one
+    static auto LinkNodes(Seq<Node*> const& nodes, size_t height) -> void {
+        size_t constexpr none = std::numeric_limits<size_t>::max();
+        size_t n_blocks = (nodes.size() + kLinkBlockSize - 1) / kLinkBlockSize;
+        // firsts[b * height + level] and lasts[b * height + level] index the first and the last node
+        // of block b on `level`
+        Seq<size_t> firsts(n_blocks * height, none);
+        Seq<size_t> lasts(n_blocks * height, none);
+        auto link = [&](size_t from, size_t to, size_t level) {
+            nodes[from]->At(level) = {.next = nodes[to], .span = to - from};
+        };
+        parlay::parallel_for(0, n_blocks, [&](size_t b) {
+            size_t* first = firsts.begin() + b * height;
+            size_t* last = lasts.begin() + b * height;
+            size_t end = std::min(nodes.size(), (b + 1) * kLinkBlockSize);
+            for (size_t i = b * kLinkBlockSize; i < end; ++i) {
+                for (size_t level = 0; level < nodes[i]->Height(); ++level) {
+                    if (last[level] == none) first[level] = i;
+                    else link(last[level], i, level);
+                    last[level] = i;
+                }
+            }
+        }, 1);
+        parlay::parallel_for(0, height, [&](size_t level) {
+            size_t next = none;
+            for (size_t b = n_blocks; b-- > 0;) {
+                if (lasts[b * height + level] != none && next != none) link(lasts[b * height + level], next, level);
+                if (firsts[b * height + level] != none) next = firsts[b * height + level];
+            }
+        }, 1);
+    }
+
     static auto CreateSentinels(size_t height) -> std::pair<Node*, Node*> {
-        Node* left_sentinel = NodeAllocator::create(util::Constants::MIN_KEY, height);
-        Node* right_sentinel = NodeAllocator::create(util::Constants::MAX_KEY, height);
+        Node* left_sentinel = NodeAllocator::CreateSentinel(height, Node::kLeftSentinel, Traits::LeftSentinelKey());
+        Node* right_sentinel = NodeAllocator::CreateSentinel(height, Node::kRightSentinel, Traits::RightSentinelKey());
         return {left_sentinel, right_sentinel};
     }
 
+    // the new levels hold only the sentinels
     auto CoerceHeightAtLeast(size_t min_height) -> void {
         if (Height() >= min_height) return;
+        size_t span = Size() + 1;
+        size_t height = Height();
+        AggregateType total = A::Identity();
+        if constexpr (kHasAggregate) {
+            for (Node* node = left_sentinel_; node != right_sentinel_; node = node->Next(height - 1)) {
+                total = A::Combine(total, LinkAggregate(node, height - 1));
+            }
+        }
         left_sentinel_->Resize(min_height, right_sentinel_);
         right_sentinel_->Resize(min_height, nullptr);
+        for (size_t level = height; level < min_height; ++level) {
+            left_sentinel_->At(level).span = span;
+            left_sentinel_->At(level).aggregate = total;
+        }
     }
 
-    auto CountDescendantsAtLevelImpl(Node* node, size_t level, size_t target_level) -> size_t {
-        assert(node != nullptr);
-        assert(level >= target_level);
-        Node* right = node->Next(level);
-        bool go_right = right != nullptr && right->Height() <= level + 1;
-        bool go_down = level > target_level;
-        node->subtree_size[level] = static_cast<size_t>(!go_down);
-        size_t right_size = 0;
-        size_t down_size = 0;
-        if (go_right && go_down) {
-            parlay::par_do(
-                    [&]() { right_size = CountDescendantsAtLevelImpl(right, level, target_level); },
-                    [&]() { down_size = CountDescendantsAtLevelImpl(node, level - 1, target_level); }
-            );
-        } else if (go_right) {
-            right_size = CountDescendantsAtLevelImpl(right, level, target_level);
-        } else if (go_down) {
-            down_size = CountDescendantsAtLevelImpl(node, level - 1, target_level);
-        }
-        return (node->subtree_size[level] += right_size + down_size);
-    }
-
-    auto CountDescendantsAtLevel(size_t level) -> size_t {
-        return CountDescendantsAtLevelImpl(left_sentinel_, Height() - 1, level);
-    }
-
-    auto CopyLayerImpl(Node* node, size_t level, size_t offset, size_t target_level, Seq<Node*>& target_layer) const -> void {
-        assert(node != nullptr);
-        assert(level >= target_level);
-        // if v->down_link_ == node->right_link_ for some node v, then node->right_link_ will be reached from v
-        Node* right = node->Next(level);
-        bool go_right = right != nullptr && right->Height() <= level + 1;
-        bool go_down = level > target_level;
-        if (!go_down) target_layer[offset] = node;
-        if (go_right && go_down) {
-            parlay::par_do(
-                    [&]() {
-                        CopyLayerImpl(right, level, offset + node->subtree_size[level] - right->subtree_size[level],
-                                      target_level, target_layer);
-                    },
-                    [&]() {
-                        CopyLayerImpl(node, level - 1, offset, target_level, target_layer);
-                    }
-            );
-        } else if (go_right) {
-            CopyLayerImpl(right, level, offset + node->subtree_size[level] - right->subtree_size[level], target_level,
-                          target_layer);
-        } else if (go_down) {
-            CopyLayerImpl(node, level - 1, offset, target_level, target_layer);
+    // links the sentinels to each other on level 0 only, dropping all other nodes
+    auto ResetSentinels() -> void {
+        left_sentinel_->Resize(1, right_sentinel_);
+        right_sentinel_->Resize(1, nullptr);
+        left_sentinel_->At(0) = {.next = right_sentinel_, .span = 1};
+        InvalidateCachedLayer();
+        Publish();
+    }
+
+    auto ShrinkHeight() -> void {
+        size_t height = Height();
+        while (height > 1 && left_sentinel_->Next(height - 1) == right_sentinel_) --height;
+        if (height == Height()) return;
+        left_sentinel_->Resize(height, right_sentinel_);
+        right_sentinel_->Resize(height, nullptr);
+        if (cached_level_ >= height) InvalidateCachedLayer();
+        Publish();
+    }
+
+    // level 0 is split into runs by the layer of this level, and the runs are processed in parallel,
+    // each one sequentially; this way, the whole level 0 is never materialized
+    static constexpr size_t kRunLevel = 4;
+
+    auto RunLevel() const -> size_t { return std::min(Height() - 1, kRunLevel); }
+
+    // calls f(i, node) for every node on level 0 from layer[i] up to its successor on `level`, for all i in parallel;
+    // the next node is read before f is called, so f may destroy the node
+    template<typename F>
+    static auto ForEachInRuns(Seq<Node*> const& layer, size_t level, F&& f) -> void {
+        parlay::parallel_for(0, layer.size(), [&](size_t i) {
+            Node* end = layer[i]->Next(level);
+            for (Node* node = layer[i]; node != end;) {
+                Node* next = node->Next(0);
+                f(i, node);
+                node = next;
+            }
+        });
+    }
+
+    // destroys all nodes but the sentinels, leaving the links of the sentinels dangling
+    auto DestroyNodes() -> void {
+        size_t level = RunLevel();
+        ForEachInRuns(GetLayer(level), level, [](size_t, Node* node) {
+            if (!node->IsSentinel()) NodeAllocator::Destroy(node);
+        });
+    }
+
+    // writes project(node) for all nodes but the sentinels in order to out[0, Size())
+    template<typename It, typename Project>
+    auto ExportTo(It out, Project project) const -> void {
+        ForEachIndexed([&](size_t i, Node const* node) { out[i] = project(node); });
+    }
+
+    // calls f(i, node) for the i-th node of the list, for all nodes but the sentinels; the offset of each run
+    // is known from the spans, so runs are visited independently
+    template<typename F>
+    auto ForEachIndexed(F&& f) const -> void {
+        size_t level = RunLevel();
+        auto layer = GetLayer(level);
+        // the left sentinel is counted in its own span
+        auto offsets = parlay::map(layer, [&](Node const* node) {
+            return node->IsRightSentinel() ? 0 : node->At(level).span - node->IsLeftSentinel();
+        });
+        parlay::scan_inplace(offsets);
+        ForEachInRuns(layer, level, [&](size_t i, Node* node) {
+            if (node->IsSentinel()) return;
+            // nodes of a run are visited in order, so the offset of the run is advanced in place
+            f(offsets[i]++, node);
+        });
+    }
+
+    // calls f(key, value) if f takes both, f(key) otherwise
+    template<typename F>
+    static auto Apply(F& f, Node const* node) -> decltype(auto) {
+        if constexpr (std::is_invocable_v<F&, Key const&, Value const&>) {
+            return f(node->key, node->value);
+        } else {
+            return f(node->key);
         }
     }
 
-    auto CopyLayer(size_t level, Seq<Node*>& target_layer) const -> void {
-        CopyLayerImpl(left_sentinel_, Height() - 1, 0, level, target_layer);
+    static auto InRange(Node const* node, Key const& lo, Key const& hi) -> bool {
+        return !node->IsSentinel() && !Less(node->key, lo) && Less(node->key, hi);
     }
 
-    auto GetLayer(size_t level) -> Seq<Node*> {
-        //return GetLayerWithLinearSpan(level);
+    // rough upper estimate of the height of a batch of the given size, used to pick the critical level
+    // when the batch's nodes are not known in advance
+    static auto ExpectedBatchHeight(size_t size) -> size_t { return std::bit_width(size) + 1; }
+
+    // for each node of `upper`, a layer of level + 1, the number of nodes on `level` from it to its successor
+    static auto CountDescendants(Seq<Node*> const& upper, size_t level) -> Seq<size_t> {
+        return parlay::map(upper, [&](Node* node) {
+            size_t count = 0;
+            for (Node* cur = node; cur != node->Next(level + 1); cur = cur->Next(level)) ++count;
+            return count;
+        });
+    }
+
+    // writes the nodes on `level` that follow each node of `upper` to target, starting at the given offsets
+    template<typename It>
+    static auto CopyDescendants(Seq<Node*> const& upper, size_t level, Seq<size_t> const& offsets, It target) -> void {
+        parlay::parallel_for(0, upper.size(), [&](size_t i) {
+            auto out = target + offsets[i];
+            for (Node* cur = upper[i]; cur != upper[i]->Next(level + 1); cur = cur->Next(level)) *out++ = cur;
+        });
+    }
+
+    // the layer of `level` - 1 below `layer`, the layer of `level`
+    static auto ExpandLayer(Seq<Node*> const& layer, size_t level) -> Seq<Node*> {
+        auto offsets = CountDescendants(layer, level - 1);
+        size_t total = parlay::scan_inplace(offsets);
+        auto expanded = Seq<Node*>::uninitialized(total);
+        CopyDescendants(layer, level - 1, offsets, expanded.begin());
+        return expanded;
+    }
+
+    // the top level has O(1) nodes in expectation; each lower layer is expanded from the one above it in parallel.
+    // A layer not above the cached one is expanded from the cache instead of from the top; a higher one is not
+    // filtered out of the cache, which may be far larger than the layers above it
+    auto GetLayer(size_t level) const -> Seq<Node*> {
         assert(level < Height());
-        size_t total = CountDescendantsAtLevel(level);
-        Seq<Node*> layer(total);
-        CopyLayer(level, layer);
+        bool from_cache = HasCachedLayer() && level <= cached_level_;
+        if (from_cache && level == cached_level_) return cached_layer_;
+        size_t upper = from_cache ? cached_level_ : Height() - 1;
+        auto layer = from_cache ? ExpandLayer(cached_layer_, upper--) : GetLayerWithLinearSpan(upper);
+        for (; upper > level; --upper) layer = ExpandLayer(layer, upper);
+        return layer;
+    }
+
+    auto HasCachedLayer() const -> bool { return !cached_layer_.empty(); }
+
+    // level 0 holds every node and no batch expands below it, so it is not kept
+    auto CacheLayer(Seq<Node*> layer, size_t level) -> void {
+        if (level == 0) return InvalidateCachedLayer();
+        cached_layer_ = std::move(layer);
+        cached_level_ = level;
+    }
+
+    auto InvalidateCachedLayer() -> void { cached_layer_.clear(); }
+
+    // the layer of `level` without the nodes whose runs up to their successors on `level` lie entirely outside
+    // [lo, hi); expanded like GetLayer, and at most two nodes per level overlap the range only partially
+    auto GetLayerInRange(size_t level, Key const& lo, Key const& hi) const -> Seq<Node*> {
+        assert(level < Height());
+        auto overlaps = [&](Node const* node, size_t l) {
+            if (node->IsRightSentinel()) return false;
+            Node const* next = node->Next(l);
+            return (node->IsLeftSentinel() || Precedes(node, hi)) && (next->IsRightSentinel() || Less(lo, next->key));
+        };
+        size_t upper = Height() - 1;
+        auto layer = parlay::filter(GetLayerWithLinearSpan(upper), [&](Node* node) { return overlaps(node, upper); });
+        for (; upper > level; --upper) {
+            layer = parlay::filter(ExpandLayer(layer, upper), [&](Node* node) { return overlaps(node, upper - 1); });
+        }
         return layer;
     }
 
@@ -200,91 +1069,454 @@ class SkipList {
         return nodes;
     }
 
+    // readers of a Snapshot may run concurrently: the batch gets a new version, which they skip, and the batch
+    // nodes are linked completely before any existing node links to them
     auto Merge(Seq<Node*>& nodes, size_t height) -> void {
-        //std::cout << "!1" << std::endl;
-        CoerceHeightAtLeast(height);
-        //std::cout << "!2" << std::endl;
+        if constexpr (config::StatsEnabled()) ++stats_.merges;
+        uint32_t version = ++version_;
+        parlay::parallel_for(0, nodes.size(), [&](size_t i) { nodes[i]->SetVersion(version); });
+        {
+            PhaseTimer timer(stats_.coerce_height_ns);
+            CoerceHeightAtLeast(height);
+        }
         size_t crit_level = Height() - height;
-        //std::cout << "!3" << std::endl;
-        auto crit_layer = GetLayer(crit_level);
-        //std::cout << "!4" << std::endl;
-        MergeHigherLevels(crit_layer, nodes, crit_level);
-        //std::cout << "!5" << std::endl;
+        Seq<Node*> crit_layer;
+        {
+            PhaseTimer timer(stats_.get_layer_ns);
+            crit_layer = GetLayer(crit_level);
+        }
+        if constexpr (config::StatsEnabled()) stats_.crit_layer_nodes += crit_layer.size();
+        auto is_new = [&](Node const* node) { return !node->IsSentinel() && node->Version() == version; };
+        std::vector<Seq<Node*>> higher_layers;
+        {
+            PhaseTimer timer(stats_.merge_higher_levels_ns);
+            higher_layers = MergeHigherLayers(crit_layer, nodes, crit_level);
+            for (size_t k = 0; k < higher_layers.size(); ++k) FillLinks(higher_layers[k], crit_level + 1 + k, is_new);
+        }
         MergeLowerLevels(crit_layer, nodes, crit_level);
-        //std::cout << "!6" << std::endl;
+        {
+            PhaseTimer timer(stats_.link_rewiring_ns);
+            for (size_t k = 0; k < higher_layers.size(); ++k) {
+                FillLinks(higher_layers[k], crit_level + 1 + k, std::not_fn(is_new));
+            }
+        }
+        PhaseTimer timer(stats_.update_spans_ns);
+        auto keys = parlay::map(nodes, [&](Node const* node) { return node->key; });
+        auto new_crit_layer = parlay::merge(crit_layer, FilterNodesHigherThan(nodes, crit_level), NodeLess);
+        UpdateSpans(new_crit_layer, keys, crit_level);
+        CacheLayer(std::move(new_crit_layer), crit_level);
+        Publish();
+    }
+
+    // inserts the nodes one at a time with finger search: the search for a key climbs from the predecessors of the
+    // previous key only as high as the distance between the keys requires, so a key d positions further costs
+    // O(log d) expected time instead of a descent from the top. Spans are kept up to date along the way
+    template<typename F>
+    auto InsertSequentially(size_t size, F&& create) -> void {
+        if constexpr (config::StatsEnabled()) {
+            ++stats_.sequential_inserts;
+            stats_.nodes_created += size;
+        }
+        uint32_t version = ++version_;
+        // preds[level] is the last node on `level` before the current key, at position positions[level]
+        std::array<Node*, config::max_height> preds;
+        std::array<size_t, config::max_height> positions;
+        preds.fill(left_sentinel_);
+        positions.fill(0);
+        for (size_t i = 0; i < size; ++i) {
+            Node* node = create(i, GenerateHeight(height_salt_, n_heights_++));
+            node->SetVersion(version);
+            if constexpr (config::StatsEnabled()) stats_.bytes_allocated += Node::AllocationSize(node->Capacity());
+            CoerceHeightAtLeast(node->Height());
+            if (node->Height() > cached_level_) InvalidateCachedLayer();
+            // the predecessors above `top` stay: their successors are not before the successor on `top + 1`
+            size_t top = 0;
+            while (top + 1 < Height() && Precedes(preds[top + 1]->Next(top + 1), node->key)) ++top;
+            Node* cur = preds[top];
+            size_t position = positions[top];
+            for (size_t level = top + 1; level-- > 0;) {
+                if (NodeLess(cur, preds[level])) {
+                    cur = preds[level];
+                    position = positions[level];
+                }
+                while (Precedes(cur->Next(level), node->key)) {
+                    position += cur->At(level).span;
+                    cur = cur->Next(level);
+                }
+                preds[level] = cur;
+                positions[level] = position;
+            }
+            // InsertOrdered requires keys that are not present yet
+            assert(!Holds(cur->Next(0), node->key));
+            size_t node_position = position + 1;
+            // levels go bottom-up, so a snapshot reader that reaches the node on some level finds it linked
+            // on that level and all below
+            for (size_t level = 0; level < Height(); ++level) {
+                auto& link = preds[level]->At(level);
+                if (level >= node->Height()) {
+                    ++link.span;
+                    if constexpr (kHasAggregate) RecomputeSpan(preds[level], level);
+                    continue;
+                }
+                node->At(level) = {.next = link.next, .span = positions[level] + link.span + 1 - node_position};
+                link.span = node_position - positions[level];
+                preds[level]->PublishNext(level, node);
+                if constexpr (kHasAggregate) {
+                    if (level > 0) {
+                        RecomputeSpan(preds[level], level);
+                        RecomputeSpan(node, level);
+                    }
+                }
+                preds[level] = node;
+                positions[level] = node_position;
+            }
+        }
+        Publish();
     }
 
-    auto MergeHigherLevels(Seq<Node*> left, Seq<Node*> right, size_t crit_level) -> void {
+    // the layers of the levels above crit_level that get batch nodes, merged with the batch;
+    // the k-th one is of level crit_level + 1 + k
+    auto MergeHigherLayers(Seq<Node*> left, Seq<Node*> right, size_t crit_level) const -> std::vector<Seq<Node*>> {
+        std::vector<Seq<Node*>> layers;
         for (size_t level = crit_level + 1; level < Height(); ++level) {
             left = FilterNodesHigherThan(left, level);
             right = FilterNodesHigherThan(right, level);
             if (right.empty()) break;
-            MergeLayer(left, right, level);
+            layers.push_back(parlay::merge(left, right, NodeLess));
         }
+        return layers;
     }
 
-    static auto FindStartingNodesInCritLayer(Seq<Node*>& crit_layer, Seq<Node*>& nodes) -> Seq<Node*> {
-        auto old_nodes = parlay::map(crit_layer, [&](Node const* node) { return std::make_pair(node, false); });
-        auto new_nodes = parlay::map(nodes, [&](Node const* node) { return std::make_pair(node, true); });
-        auto merged = parlay::merge(old_nodes, new_nodes, [&](auto const& lhs, auto const& rhs) {
-            return lhs.first->key < rhs.first->key;
+    // for each key, the index in crit_layer of the last node whose key is strictly smaller
+    static auto FindStartingIndicesInCritLayer(Seq<Node*> const& crit_layer, Seq<Key> const& keys) -> Seq<size_t> {
+        // the sentinels are left out, and an inner node at position i is counted as i + 1
+        auto inner = crit_layer.cut(1, crit_layer.size() - 1);
+        auto old_keys = parlay::map(inner, [&](Node const* node) { return std::make_pair(node->key, false); });
+        auto new_keys = parlay::map(keys, [&](Key const& key) { return std::make_pair(key, true); });
+        // a query goes before an existing node with an equal key
+        auto merged = parlay::merge(old_keys, new_keys, [&](auto const& lhs, auto const& rhs) {
+            return Less(lhs.first, rhs.first) || (lhs.second && !rhs.second && !Less(rhs.first, lhs.first));
         });
         auto is_new = parlay::map(merged, [&](auto const& x) { return x.second; });
         auto sums = parlay::map(merged, [&](auto const& x) { return static_cast<size_t>(!x.second); });
         parlay::scan_inplace(sums);
-        auto indices = parlay::pack(sums, is_new);
-        return parlay::map(indices, [&](size_t i) { return crit_layer[i - 1]; });
+        return parlay::pack(sums, is_new);
+    }
+
+    static auto FindStartingNodesInCritLayer(Seq<Node*>& crit_layer, Seq<Node*>& nodes) -> Seq<Node*> {
+        auto keys = parlay::map(nodes, [&](Node const* node) { return node->key; });
+        auto indices = FindStartingIndicesInCritLayer(crit_layer, keys);
+        return parlay::map(indices, [&](size_t i) { return crit_layer[i]; });
     }
 
-    auto PrepareInsert(Node* node, size_t level, Node* new_node) -> void {
+    // the batch nodes are linked among themselves; on each level, a batch node is preceded by its predecessor
+    // in the list unless the previous batch node is closer, and similarly for the successor
+    // returns the number of nodes visited on the way down
+    static auto PrepareInsert(Node* node, size_t level, Node* new_node, MergeScratch<Node>& scratch, size_t i)
+            -> size_t {
+        size_t visited = 1;
         while (true) {
             if (new_node->Height() > level) {
-                if (node->key >= new_node->prev_key[level]) {
-                    new_node->new_prev[level] = node;
+                auto& entry = scratch.At(i, level);
+                if (entry.prev == nullptr || NodeLess(entry.prev, node)) {
+                    entry.new_prev = node;
                 }
-                if (new_node->Next(level) == nullptr || new_node->Next(level)->key > node->Next(level)->key) {
-                    new_node->new_next[level] = node->Next(level);
+                if (new_node->Next(level) == nullptr || NodeLess(node->Next(level), new_node->Next(level))) {
+                    entry.new_next = node->Next(level);
                 }
             }
             if (level == 0) break;
             --level;
-            while (node->Next(level)->key < new_node->key) node = node->Next(level);
+            while (Precedes(node->Next(level), new_node->key)) {
+                node = node->Next(level);
+                ++visited;
+            }
         }
+        // InsertOrdered requires keys that are not present yet
+        assert(!Holds(node->Next(0), new_node->key));
+        return visited;
     }
 
     auto MergeLowerLevels(Seq<Node*>& crit_layer, Seq<Node*>& nodes, size_t crit_level) -> void {
-        //std::cout << "!7" << std::endl;
-        auto starting_nodes = FindStartingNodesInCritLayer(crit_layer, nodes);
-        //std::cout << "!8" << std::endl;
-        parlay::parallel_for(0, nodes.size(), [&](size_t i) { PrepareInsert(starting_nodes[i], crit_level, nodes[i]); });
-        //std::cout << "!9" << std::endl;
+        Seq<Node*> starting_nodes;
+        {
+            PhaseTimer timer(stats_.find_starting_nodes_ns);
+            starting_nodes = FindStartingNodesInCritLayer(crit_layer, nodes);
+        }
+        MergeScratch<Node> scratch(nodes, crit_level + 1);
+        {
+            PhaseTimer timer(stats_.prepare_insert_ns);
+            FillPrevNodes(nodes, crit_level, scratch);
+            [[maybe_unused]] Seq<size_t> visits(config::StatsEnabled() ? nodes.size() : 0);
+            parlay::parallel_for(0, nodes.size(), [&](size_t i) {
+                [[maybe_unused]] size_t visited = PrepareInsert(starting_nodes[i], crit_level, nodes[i], scratch, i);
+                if constexpr (config::StatsEnabled()) visits[i] = visited;
+            });
+            if constexpr (config::StatsEnabled()) stats_.prepare_insert_visits += parlay::reduce(visits);
+        }
+        PhaseTimer timer(stats_.link_rewiring_ns);
+        // the batch nodes are linked to their successors first, so that they are complete when published
         parlay::parallel_for(0, nodes.size(), [&](size_t i) {
             auto node = nodes[i];
-            parlay::parallel_for(0, node->Height(), [&](size_t level) {
-               if (node->new_prev[level] != nullptr) {
-                   node->new_prev[level]->next[level] = node;
-                   node->new_prev[level] = nullptr;
+            parlay::parallel_for(0, std::min(node->Height(), crit_level + 1), [&](size_t level) {
+               auto const& entry = scratch.At(i, level);
+               if (entry.new_next != nullptr) {
+                   node->At(level).next = entry.new_next;
                }
-               if (node->new_next[level] != nullptr) {
-                   node->next[level] = node->new_next[level];
-                   node->new_next[level] = nullptr;
+            });
+        });
+        parlay::parallel_for(0, nodes.size(), [&](size_t i) {
+            auto node = nodes[i];
+            parlay::parallel_for(0, std::min(node->Height(), crit_level + 1), [&](size_t level) {
+               auto const& entry = scratch.At(i, level);
+               if (entry.new_prev != nullptr) {
+                   entry.new_prev->PublishNext(level, node);
                }
             });
         });
     }
 
-    static auto MergeLayer(Seq<Node*>& left, Seq<Node*>& right, size_t level) -> void {
-        auto order = parlay::merge(left, right, [&](Node const* lhs, Node* const rhs) {
-            return lhs->key < rhs->key;
+    static auto FillPrevNodes(Seq<Node*> const& nodes, size_t crit_level, MergeScratch<Node>& scratch) -> void {
+        auto layer = parlay::tabulate(nodes.size(), [](size_t i) { return i; });
+        for (size_t level = 0; level <= crit_level && !layer.empty();) {
+            parlay::parallel_for(1, layer.size(), [&](size_t i) {
+                scratch.At(layer[i], level).prev = nodes[layer[i - 1]];
+            });
+            ++level;
+            layer = parlay::filter(layer, [&](size_t i) { return nodes[i]->Height() > level; });
+        }
+    }
+
+    // for each of the sorted keys, the last node on level 0 with a smaller key
+    auto FindPredecessorsOrdered(Seq<Key> const& keys) const -> Seq<Node*> {
+        // a small batch searches from the top directly instead of expanding the critical layer
+        if (keys.size() <= config::small_batch_size) {
+            return parlay::map(keys, [&](Key const& key) { return FindPredecessor(left_sentinel_, Height() - 1, key); });
+        }
+        size_t height = std::min(Height(), ExpectedBatchHeight(keys.size()));
+        size_t crit_level = Height() - height;
+        auto crit_layer = GetLayer(crit_level);
+        auto starting_indices = FindStartingIndicesInCritLayer(crit_layer, keys);
+        return parlay::tabulate(keys.size(), [&](size_t i) {
+            return FindPredecessor(crit_layer[starting_indices[i]], crit_level, keys[i]);
         });
-        FillLinks(order, level);
     }
 
-    static auto FillLinks(Seq<Node*> nodes, size_t level) -> void {
+    static constexpr size_t kLookupGroupSize = 16;
+    static constexpr size_t kLookupBlockSize = 1024;
+
+    template<size_t kGroupSize>
+    auto ContainsInGroups(std::span<Key const> keys) const -> Seq<bool> {
+        auto result = Seq<bool>::uninitialized(keys.size());
+        DescendInGroups<kGroupSize>(keys, [&](size_t i, Node* pred) { result[i] = Holds(pred->Next(0), keys[i]); });
+        return result;
+    }
+
+    // calls finish(i, node) with the last node on level 0 with a key smaller than keys[i], for all i.
+    // The queries of each block are processed kGroupSize at a time in round-robin, one step of a descent per turn;
+    // a finished descent hands its slot to the next query of the block
+    template<size_t kGroupSize, typename F>
+    auto DescendInGroups(std::span<Key const> keys, F&& finish) const -> void {
+        struct Descent {
+            size_t index;
+            Node* node;
+            size_t level;
+        };
+        size_t n_blocks = (keys.size() + kLookupBlockSize - 1) / kLookupBlockSize;
+        parlay::parallel_for(0, n_blocks, [&](size_t b) {
+            size_t next = b * kLookupBlockSize;
+            size_t end = std::min(keys.size(), next + kLookupBlockSize);
+            auto start = [&](Descent& descent) {
+                descent = {.index = next++, .node = left_sentinel_, .level = Height() - 1};
+                util::Prefetch(descent.node->Next(descent.level));
+            };
+            std::array<Descent, kGroupSize> group;
+            size_t active = 0;
+            for (; active < kGroupSize && next < end; ++active) start(group[active]);
+            while (active > 0) {
+                for (size_t g = 0; g < active;) {
+                    Descent& descent = group[g];
+                    Key const& key = keys[descent.index];
+                    Node* succ = descent.node->Next(descent.level);
+                    if (Precedes(succ, key)) {
+                        descent.node = succ;
+                    } else if (descent.level > 0) {
+                        --descent.level;
+                    } else {
+                        finish(descent.index, descent.node);
+                        if (next == end) {
+                            // the last active descent takes this slot and makes its step in this turn
+                            descent = group[--active];
+                            continue;
+                        }
+                        start(descent);
+                        ++g;
+                        continue;
+                    }
+                    util::Prefetch(descent.node->Next(descent.level));
+                    ++g;
+                }
+            }
+        }, 1);
+    }
+
+    // descends from `node` (which must precede the key on `level`) to the last node on level 0 with a smaller key
+    static auto FindPredecessor(Node* node, size_t level, Key const& key) -> Node* {
+        while (true) {
+            while (Precedes(node->Next(level), key)) node = node->Next(level);
+            if (level == 0) return node;
+            --level;
+        }
+    }
+
+    // returns the node holding the key (nullptr if there is none), and for each level below `level`
+    // stores the last node with a smaller key in preds
+    template<typename It>
+    static auto PrepareErase(Node* node, size_t level, Key const& key, It preds) -> Node* {
+        Node* target = Holds(node->Next(level), key) ? node->Next(level) : nullptr;
+        while (level > 0) {
+            --level;
+            while (Precedes(node->Next(level), key)) node = node->Next(level);
+            preds[level] = node;
+            if (Holds(node->Next(level), key)) target = node->Next(level);
+        }
+        return target;
+    }
+
+    // relinks the levels from crit_level up, which consist only of the surviving nodes of the critical layer
+    static auto UnlinkHigherLevels(Seq<Node*> layer, size_t crit_level) -> void {
+        for (size_t level = crit_level; layer.size() > 1;) {
+            FillLinks(layer, level++);
+            layer = FilterNodesHigherThan(layer, level);
+        }
+    }
+
+    // on each level below crit_level, erased nodes form runs of consecutive nodes;
+    // the predecessor of the first node in a run is linked to the successor of the last one
+    static auto UnlinkLowerLevels(Seq<Node*> const& targets, Seq<Node*> const& preds, size_t crit_level) -> void {
+        auto found = parlay::pack_index(parlay::map(targets, [](Node const* node) { return node != nullptr; }));
+        parlay::parallel_for(0, crit_level, [&](size_t level) {
+            auto layer = parlay::filter(found, [&](size_t i) { return targets[i]->Height() > level; });
+            if (layer.empty()) return;
+            auto is_first = parlay::tabulate(layer.size(), [&](size_t i) {
+                return i == 0 || preds[layer[i] * crit_level + level] != targets[layer[i - 1]];
+            });
+            auto is_last = parlay::tabulate(layer.size(), [&](size_t i) {
+                return i + 1 == layer.size() || targets[layer[i]]->Next(level) != targets[layer[i + 1]];
+            });
+            auto firsts = parlay::pack(layer, is_first);
+            auto lasts = parlay::pack(layer, is_last);
+            parlay::parallel_for(0, firsts.size(), [&](size_t i) {
+                preds[firsts[i] * crit_level + level]->At(level).next = targets[lasts[i]]->Next(level);
+            });
+        });
+    }
+
+    // after a batch update with the given keys, the spans that may have changed on a level up to crit_level
+    // are those of the nodes preceding the keys and of the nodes holding them; the levels above crit_level
+    // consist of crit_layer only and are recomputed entirely
+    auto UpdateSpans(Seq<Node*> const& crit_layer, Seq<Key> const& keys, size_t crit_level) -> void {
+        if (crit_level >= Height()) {
+            return UpdateSpans(FilterNodesHigherThan(crit_layer, Height() - 1), keys, Height() - 1);
+        }
+        size_t n_levels = crit_level + 1;
+        auto starting_indices = FindStartingIndicesInCritLayer(crit_layer, keys);
+        Seq<Node*> paths(keys.size() * n_levels);
+        parlay::parallel_for(0, keys.size(), [&](size_t i) {
+            Node* node = crit_layer[starting_indices[i]];
+            for (size_t level = crit_level;; --level) {
+                while (Precedes(node->Next(level), keys[i])) node = node->Next(level);
+                paths[i * n_levels + level] = node;
+                if (level == 0) break;
+            }
+        });
+        for (size_t level = 1; level <= crit_level; ++level) {
+            auto preds = parlay::tabulate(keys.size(), [&](size_t i) { return paths[i * n_levels + level]; });
+            auto holders = parlay::filter(
+                    parlay::tabulate(keys.size(), [&](size_t i) {
+                        return Holds(preds[i]->Next(level), keys[i]) ? preds[i]->Next(level) : nullptr;
+                    }),
+                    [](Node* const node) { return node != nullptr; });
+            auto candidates = parlay::merge(preds, holders, NodeLess);
+            auto is_unique = parlay::tabulate(candidates.size(), [&](size_t i) {
+                return i == 0 || candidates[i] != candidates[i - 1];
+            });
+            auto nodes = parlay::pack(candidates, is_unique);
+            parlay::parallel_for(0, nodes.size(), [&](size_t i) { RecomputeSpan(nodes[i], level); });
+        }
+        Seq<Node*> layer;
+        for (size_t level = crit_level + 1; level < Height(); ++level) {
+            layer = FilterNodesHigherThan(level == crit_level + 1 ? crit_layer : layer, level);
+            parlay::parallel_for(0, layer.size(), [&](size_t i) { RecomputeSpan(layer[i], level); });
+        }
+    }
+
+    // recomputes the span, and the aggregate if there is one, of the link of node on `level` from the level below
+    static auto RecomputeSpan(Node* node, size_t level) -> void {
+        assert(level > 0);
+        size_t span = 0;
+        AggregateType aggregate = A::Identity();
+        for (Node* cur = node; cur != node->Next(level); cur = cur->Next(level - 1)) {
+            span += cur->At(level - 1).span;
+            if constexpr (kHasAggregate) aggregate = A::Combine(aggregate, LinkAggregate(cur, level - 1));
+        }
+        node->At(level).span = span;
+        if constexpr (kHasAggregate) node->At(level).aggregate = aggregate;
+    }
+
+    // A over the nodes skipped by the link of node on `level`; on level 0, that is the node alone
+    static auto LinkAggregate(Node const* node, size_t level) -> AggregateType {
+        if (level > 0) return node->At(level).aggregate;
+        return node->IsSentinel() ? A::Identity() : A::Of(node->key, node->value);
+    }
+
+    // recomputes the spans and aggregates of all links above level 0 of a list from the array of all its nodes,
+    // level by level
+    static auto RecomputeSpans(Seq<Node*> const& nodes, size_t height) -> void {
+        Seq<Node*> layer;
+        for (size_t level = 1; level < height; ++level) {
+            layer = FilterNodesHigherThan(level == 1 ? nodes : layer, level);
+            parlay::parallel_for(0, layer.size() - 1, [&](size_t i) { RecomputeSpan(layer[i], level); });
+        }
+    }
+
+    auto RankOf(Key const& key) const -> size_t {
+        size_t rank = 0;
+        Node* node = left_sentinel_;
+        for (size_t level = Height(); level-- > 0;) {
+            while (Precedes(node->Next(level), key)) {
+                rank += node->At(level).span;
+                node = node->Next(level);
+            }
+        }
+        return rank;
+    }
+
+    auto SelectAt(size_t index) const -> Key {
+        assert(index < Size());
+        // the left sentinel is at position 0
+        size_t target = index + 1;
+        size_t position = 0;
+        Node* node = left_sentinel_;
+        for (size_t level = Height(); level-- > 0;) {
+            while (position + node->At(level).span <= target) {
+                position += node->At(level).span;
+                node = node->Next(level);
+            }
+        }
+        return node->key;
+    }
+
+    static auto FillLinks(Seq<Node*> const& nodes, size_t level) -> void {
+        FillLinks(nodes, level, [](Node const*) { return true; });
+    }
+
+    // links only the nodes for which filter holds
+    template<typename Filter>
+    static auto FillLinks(Seq<Node*> const& nodes, size_t level, Filter filter) -> void {
         assert(!nodes.empty());
         parlay::parallel_for(0, nodes.size() - 1, [&](size_t i) {
-            nodes[i]->next[level] = nodes[i + 1];
-            nodes[i + 1]->prev_key[level] = nodes[i]->key;
+            if (filter(nodes[i])) nodes[i]->PublishNext(level, nodes[i + 1]);
         });
     }
 
@@ -292,10 +1524,40 @@ class SkipList {
         return parlay::filter(nodes, [&](Node* const node) { return node->Height() > height; });
     }
 
-    static auto GenerateHeight() -> size_t { return util::random::NextGeometric() + 1; }
+    // heights are a pure function of config::seed, the salt of the list and a per-list index that grows with every
+    // node created, so the same sequence of operations builds the same structure regardless of the number of workers.
+    // Without the salt, lists built side by side, such as shards, or the parts of a split, would draw the same heights
+    static auto GenerateHeight(uint64_t salt, uint64_t index) -> size_t {
+        uint64_t hash = util::random::Mix64(util::random::Mix64(config::seed ^ util::random::Mix64(salt)) + index);
+        // one level is left for the sentinels to stay above every node
+        return std::min(util::random::GeometricFromHash(hash) + 1, config::max_height - 1);
+    }
+
+    // every list takes the next salt when it is created, including the parts of a split and the result of a join;
+    // lists created concurrently take theirs in no fixed order
+    static auto NewHeightSalt() -> uint64_t {
+        static std::atomic<uint64_t> n_lists = 0;
+        return n_lists.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // reserves `count` consecutive indices for GenerateHeight and returns the first one
+    auto DrawHeightIndices(size_t count) -> uint64_t { return std::exchange(n_heights_, n_heights_ + count); }
 
-    Node* const left_sentinel_;
-    Node* const right_sentinel_;
+    Node* left_sentinel_;
+    Node* right_sentinel_;
+    // the layer of cached_level_ as left by the last batch merge or erase, which computes it anyway, so that
+    // the next batch at least as large does not derive its critical layer from the top again; empty when stale
+    Seq<Node*> cached_layer_;
+    size_t cached_level_ = 0;
+    // mixed into the heights drawn for this list, which then differ from those of any other list
+    uint64_t height_salt_ = NewHeightSalt();
+    // the number of heights drawn for this list
+    uint64_t n_heights_ = 0;
+    // the version of the last batch inserted; nodes are stamped with the version of their batch
+    uint32_t version_ = 0;
+    // version_ << 8 | Height() as of the last completed update, for snapshots
+    std::atomic<uint64_t> published_ = 0;
+    SkipListStats stats_;
 };
 
 }
@@ -0,0 +1,58 @@
+#ifndef PBSL_STATS_HPP
+#define PBSL_STATS_HPP
+
+#include <chrono>
+#include <cstdint>
+
+#include "config.hpp"
+
+namespace pbsl {
+
+// totals over the lifetime of a list, or since its last ResetStats; stays zero unless config::StatsEnabled()
+struct SkipListStats {
+    // batches inserted with the parallel merge and with finger search
+    uint64_t merges = 0;
+    uint64_t sequential_inserts = 0;
+
+    // wall time of each phase, in nanoseconds
+    uint64_t create_nodes_ns = 0;         // drawing heights and allocating nodes
+    uint64_t link_nodes_ns = 0;           // linking a new batch among itself
+    uint64_t coerce_height_ns = 0;
+    uint64_t get_layer_ns = 0;
+    uint64_t merge_higher_levels_ns = 0;
+    uint64_t find_starting_nodes_ns = 0;
+    uint64_t prepare_insert_ns = 0;       // including the merge scratch and its prev entries
+    uint64_t link_rewiring_ns = 0;
+    uint64_t update_spans_ns = 0;
+
+    uint64_t nodes_created = 0;
+    uint64_t bytes_allocated = 0;
+    uint64_t crit_layer_nodes = 0;        // summed over merges
+    uint64_t prepare_insert_visits = 0;   // nodes visited by the descents of PrepareInsert
+};
+
+// adds the wall time of its scope to a counter; compiles to nothing when stats are disabled
+class PhaseTimer {
+  public:
+    explicit PhaseTimer(uint64_t& total_ns) : total_ns_(total_ns) {
+        if constexpr (config::StatsEnabled()) start_ = std::chrono::steady_clock::now();
+    }
+
+    PhaseTimer(PhaseTimer const&) = delete;
+    auto operator=(PhaseTimer const&) -> PhaseTimer& = delete;
+
+    ~PhaseTimer() {
+        if constexpr (config::StatsEnabled()) {
+            auto elapsed = std::chrono::steady_clock::now() - start_;
+            total_ns_ += std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+        }
+    }
+
+  private:
+    uint64_t& total_ns_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+}
+
+#endif //PBSL_STATS_HPP
@@ -0,0 +1,310 @@
+#ifndef PBSL_UNROLLED_SKIP_LIST_HPP
+#define PBSL_UNROLLED_SKIP_LIST_HPP
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <span>
+#include <type_traits>
+#include <utility>
+
+#include <parlay/alloc.h>
+#include <parlay/parallel.h>
+#include <parlay/primitives.h>
+#include <parlay/sequence.h>
+
+#include "config.hpp"
+#include "util.hpp"
+#include "skip_list.hpp"
+
+namespace pbsl {
+
+// An ordered set of keys whose bottom level is unrolled: keys are stored in sorted blocks of kBlockBytes,
+// and only the blocks get nodes, in a SkipList from the first key of each block to the block.
+// A block holds keys not smaller than its own separator and smaller than the next one; erasing keys may leave
+// a separator below the smallest key of its block, which still routes searches correctly.
+// Blocks that underflow are not merged; only those left empty by an erase are dropped.
+// Scans and the last step of a search read a block sequentially instead of chasing a pointer per key.
+template<typename K = config::Key, typename Compare = std::less<K>, size_t kBlockBytes = 256>
+    requires std::is_trivially_copyable_v<K>
+class UnrolledSkipList {
+  public:
+    using Key = K;
+    template<typename T> using Seq = util::types::Seq<T>;
+
+    struct Block {
+        static constexpr size_t kCapacity = (kBlockBytes - sizeof(uint32_t)) / sizeof(Key);
+        static_assert(kCapacity >= 2, "a block must fit at least two keys");
+
+        uint32_t size = 0;
+        std::array<Key, kCapacity> keys;
+
+        auto Keys() const -> std::span<Key const> { return {keys.data(), size}; }
+    };
+
+    using Index = SkipList<Key, Block*, Compare>;
+
+    static constexpr size_t kBlockCapacity = Block::kCapacity;
+    // blocks are built and split to this many keys, leaving room for later insertions before they split again
+    static constexpr size_t kBlockFill = std::max<size_t>(1, kBlockCapacity * 3 / 4);
+
+    // keys must be sorted and unique
+    static auto FromOrderedKeys(Seq<Key> const& keys) -> UnrolledSkipList {
+        assert(!keys.empty());
+        return UnrolledSkipList(Index::FromOrderedEntries(BuildBlocks(keys.cut(0, keys.size()))));
+    }
+
+    // a moved-from list may only be destroyed or assigned to; assignment swaps the blocks as well
+    UnrolledSkipList(UnrolledSkipList&&) noexcept = default;
+
+    auto operator=(UnrolledSkipList&&) noexcept -> UnrolledSkipList& = default;
+
+    ~UnrolledSkipList() {
+        // a moved-from list holds no index
+        if (index_.left_sentinel_ == nullptr) return;
+        DestroyBlocks();
+    }
+
+    auto Clear() -> void {
+        DestroyBlocks();
+        index_.Clear();
+    }
+
+    // keys must be sorted, unique and not present in the list. The batch is split into segments by the block
+    // that each key falls into, and each segment is merged into its block in parallel; a block that overflows
+    // is split into blocks of kBlockFill keys, whose separators are inserted into the index as one batch
+    auto InsertOrdered(Seq<Key> const& keys) -> void {
+        assert(!keys.empty());
+        auto owners = FindOwners(keys);
+        // keys smaller than every separator, or all of them in an empty list, make new blocks of their own
+        size_t head = CountUnowned(owners);
+        auto starts = SegmentStarts(owners, head);
+        auto new_blocks = parlay::tabulate(starts.size(), [&](size_t s) {
+            size_t end = s + 1 < starts.size() ? starts[s + 1] : keys.size();
+            return MergeIntoBlock(owners[starts[s]]->value, keys.cut(starts[s], end));
+        });
+        auto entries = BuildBlocks(keys.cut(0, head));
+        entries.append(parlay::flatten(new_blocks));
+        if (!entries.empty()) index_.InsertOrdered(entries);
+    }
+
+    // keys may come in any order and contain duplicates and keys that are already present
+    auto Insert(Seq<Key> keys) -> void {
+        if (keys.empty()) return;
+        parlay::sort_inplace(keys, Compare{});
+        auto owners = FindOwners(keys);
+        auto is_new = parlay::tabulate(keys.size(), [&](size_t i) {
+            return (i == 0 || Index::Less(keys[i - 1], keys[i])) && !BlockHolds(owners[i], keys[i]);
+        });
+        keys = parlay::pack(keys, is_new);
+        if (!keys.empty()) InsertOrdered(keys);
+    }
+
+    // keys must be sorted and unique; keys that are not present are ignored. Blocks left empty are removed
+    // from the index and freed
+    auto EraseOrdered(Seq<Key> const& keys) -> void {
+        assert(!keys.empty());
+        auto owners = FindOwners(keys);
+        size_t head = CountUnowned(owners);
+        auto starts = SegmentStarts(owners, head);
+        auto is_emptied = parlay::tabulate(starts.size(), [&](size_t s) {
+            size_t end = s + 1 < starts.size() ? starts[s + 1] : keys.size();
+            return EraseFromBlock(owners[starts[s]]->value, keys.cut(starts[s], end));
+        });
+        auto emptied = parlay::pack(parlay::map(starts, [&](size_t i) { return owners[i]; }), is_emptied);
+        if (emptied.empty()) return;
+        auto blocks = parlay::map(emptied, [](Node const* node) { return node->value; });
+        index_.EraseOrdered(parlay::map(emptied, [](Node const* node) { return node->key; }));
+        parlay::parallel_for(0, blocks.size(), [&](size_t i) { FreeBlock(blocks[i]); });
+    }
+
+    // whether each key is present; the keys may come in any order. The descents through the index are
+    // interleaved as in SkipList::Contains, and then the blocks are searched with the next ones prefetched
+    auto Contains(std::span<Key const> keys) const -> Seq<bool> {
+        auto owners = Seq<Node*>::uninitialized(keys.size());
+        index_.template DescendInGroups<Index::kLookupGroupSize>(keys, [&](size_t i, Node* pred) {
+            // a separator may outlive its key, so the block is searched even if the key is one
+            owners[i] = Index::Holds(pred->Next(0), keys[i]) ? pred->Next(0) : pred;
+        });
+        return parlay::tabulate(keys.size(), [&](size_t i) {
+            if (i + kPrefetchDistance < keys.size() && !owners[i + kPrefetchDistance]->IsLeftSentinel()) {
+                PrefetchBlock(owners[i + kPrefetchDistance]->value);
+            }
+            return BlockHolds(owners[i], keys[i]);
+        });
+    }
+
+    auto Size() const -> size_t {
+        return index_.Reduce([](Key const&, Block* block) { return size_t{block->size}; }, parlay::plus<size_t>());
+    }
+
+    auto IsEmpty() const -> bool { return index_.IsEmpty(); }
+
+    // number of blocks, that is, of nodes in the index
+    auto BlockCount() const -> size_t { return index_.Size(); }
+
+    // bytes taken by the index and the blocks, not counting the allocators' own overhead
+    auto AllocatedBytes() const -> size_t { return index_.AllocatedBytes() + BlockCount() * sizeof(Block); }
+
+    // all keys in order
+    auto ToSequence() const -> Seq<Key> {
+        Seq<Key> keys(Size());
+        CopyTo(keys.begin());
+        return keys;
+    }
+
+    // writes all keys in order to out[0, Size()); the offset of each block is known from the sizes of the blocks
+    // before it, so blocks are copied independently
+    template<typename It>
+    auto CopyTo(It out) const -> void {
+        auto blocks = Blocks();
+        auto offsets = parlay::map(blocks, [](Block const* block) { return size_t{block->size}; });
+        parlay::scan_inplace(offsets);
+        parlay::parallel_for(0, blocks.size(), [&](size_t i) {
+            std::copy(blocks[i]->keys.begin(), blocks[i]->keys.begin() + blocks[i]->size, out + offsets[i]);
+        });
+    }
+
+    // calls f(key) for every key, in parallel and in no particular order
+    template<typename F>
+    auto ForEach(F&& f) const -> void {
+        index_.ForEach([&](Key const&, Block* block) {
+            for (Key const& key : block->Keys()) f(key);
+        });
+    }
+
+  private:
+    using Node = typename Index::Node;
+    using Entry = typename Index::Entry;
+
+    explicit UnrolledSkipList(Index index) : index_(std::move(index)) {}
+
+    // the blocks in order
+    auto Blocks() const -> Seq<Block*> {
+        return parlay::map(index_.ToEntries(), [](Entry const& entry) { return entry.second; });
+    }
+
+    // for each of the sorted keys, the node of the block it falls into: the last one whose separator is not
+    // greater than the key, or the left sentinel if there is none
+    auto FindOwners(Seq<Key> const& keys) const -> Seq<Node*> {
+        auto preds = index_.FindPredecessorsOrdered(keys);
+        return parlay::tabulate(keys.size(), [&](size_t i) {
+            Node* next = preds[i]->Next(0);
+            return Index::Holds(next, keys[i]) ? next : preds[i];
+        });
+    }
+
+    // number of keys that fall before the first block; they come first, as the keys are sorted
+    static auto CountUnowned(Seq<Node*> const& owners) -> size_t {
+        return static_cast<size_t>(std::partition_point(owners.begin(), owners.end(), [](Node const* node) {
+            return node->IsLeftSentinel();
+        }) - owners.begin());
+    }
+
+    static constexpr size_t kPrefetchDistance = 8;
+
+    static auto PrefetchBlock(Block const* block) -> void {
+        for (size_t offset = 0; offset < sizeof(Block); offset += 64) {
+            util::Prefetch(reinterpret_cast<std::byte const*>(block) + offset);
+        }
+    }
+
+    // whether the block of the owner, as found by FindOwners, holds the key
+    static auto BlockHolds(Node const* owner, Key const& key) -> bool {
+        if (owner->IsLeftSentinel()) return false;
+        auto keys = owner->value->Keys();
+        return std::binary_search(keys.begin(), keys.end(), key, Compare{});
+    }
+
+    // indices from `first` on where a new block begins among the owners of the sorted keys
+    static auto SegmentStarts(Seq<Node*> const& owners, size_t first) -> Seq<size_t> {
+        return parlay::pack_index(parlay::tabulate(owners.size(), [&](size_t i) {
+            return i >= first && (i == first || owners[i] != owners[i - 1]);
+        }));
+    }
+
+    // cuts sorted keys into blocks of kBlockFill keys, as entries for the index
+    template<typename Keys>
+    static auto BuildBlocks(Keys const& keys) -> Seq<Entry> {
+        size_t n_blocks = (keys.size() + kBlockFill - 1) / kBlockFill;
+        return parlay::tabulate(n_blocks, [&](size_t b) {
+            size_t begin = b * keys.size() / n_blocks;
+            size_t end = (b + 1) * keys.size() / n_blocks;
+            Block* block = CreateBlock(keys.begin() + begin, keys.begin() + end);
+            return Entry(block->keys[0], block);
+        });
+    }
+
+    // merges the keys, which all fall into the block, into it; returns the blocks split off if it overflows,
+    // as entries for the index. The block itself keeps the smallest keys, so its separator stays valid.
+    // On overflow, the keys greater than the last key of the block, e.g. all of them for appends, are cut into
+    // blocks of their own in parallel, and only the others are merged with the block, so a large segment
+    // is not merged key by key
+    template<typename Keys>
+    static auto MergeIntoBlock(Block* block, Keys const& keys) -> Seq<Entry> {
+        assert(block->size > 0);
+        size_t total = block->size + keys.size();
+        if (total <= kBlockCapacity) {
+            std::array<Key, kBlockCapacity> merged;
+            std::merge(block->keys.begin(), block->keys.begin() + block->size, keys.begin(), keys.end(),
+                       merged.begin(), Compare{});
+            std::copy_n(merged.begin(), total, block->keys.begin());
+            block->size = static_cast<uint32_t>(total);
+            return {};
+        }
+        size_t below = static_cast<size_t>(std::lower_bound(keys.begin(), keys.end(), block->keys[block->size - 1],
+                                                            Compare{}) - keys.begin());
+        auto after = BuildBlocks(keys.cut(below, keys.size()));
+        if (below == 0) return after;
+        auto merged = parlay::merge(block->Keys(), keys.cut(0, below), Compare{});
+        size_t n_blocks = merged.size() <= kBlockCapacity ? 1 : (merged.size() + kBlockFill - 1) / kBlockFill;
+        size_t first_end = merged.size() / n_blocks;
+        std::copy_n(merged.begin(), first_end, block->keys.begin());
+        block->size = static_cast<uint32_t>(first_end);
+        auto entries = BuildBlocks(merged.cut(first_end, merged.size()));
+        entries.append(after);
+        return entries;
+    }
+
+    // erases those of the sorted keys that are present from the block; returns whether it is left empty.
+    // The kept keys are moved down in place, so the write index never passes the read index
+    template<typename Keys>
+    static auto EraseFromBlock(Block* block, Keys const& keys) -> bool {
+        auto erased = keys.begin();
+        size_t size = 0;
+        for (size_t i = 0; i < block->size; ++i) {
+            Key key = block->keys[i];
+            while (erased != keys.end() && Index::Less(*erased, key)) ++erased;
+            if (erased != keys.end() && !Index::Less(key, *erased)) continue;
+            block->keys[size++] = key;
+        }
+        block->size = static_cast<uint32_t>(size);
+        return size == 0;
+    }
+
+    template<typename It>
+    static auto CreateBlock(It begin, It end) -> Block* {
+        assert(0 < end - begin && static_cast<size_t>(end - begin) <= kBlockCapacity);
+        Block* block = new(parlay::type_allocator<Block>::alloc()) Block;
+        block->size = static_cast<uint32_t>(std::copy(begin, end, block->keys.begin()) - block->keys.begin());
+        return block;
+    }
+
+    static auto FreeBlock(Block* block) -> void {
+        block->~Block();
+        parlay::type_allocator<Block>::free(block);
+    }
+
+    auto DestroyBlocks() -> void {
+        index_.ForEach([](Key const&, Block* block) { FreeBlock(block); });
+    }
+
+    Index index_;
+};
+
+}
+
+#endif //PBSL_UNROLLED_SKIP_LIST_HPP
@@ -1,7 +1,12 @@
 #ifndef PBSL_UTIL_HPP
 #define PBSL_UTIL_HPP
 
-#include <random>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <type_traits>
 #include <parlay/sequence.h>
 
 #include "config.hpp"
@@ -20,19 +25,53 @@ using KeySeq = Seq<config::Key>;
 
 namespace random {
 
-auto NextGeometric(double p = 0.5) -> size_t {
-    static thread_local std::random_device rd;
-    static thread_local std::mt19937 gen(rd());
-    return std::geometric_distribution<size_t>(p)(gen);
+// a bijective mix of 64 bits, the finalizer of SplitMix64
+constexpr auto Mix64(uint64_t x) -> uint64_t {
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
 }
 
+// the number of failures before the first success in trials with success probability config::p,
+// derived from a uniformly distributed hash; with p = 1/2, every bit is one trial
+inline auto GeometricFromHash(uint64_t hash) -> size_t {
+    if constexpr (config::p == 0.5) {
+        return static_cast<size_t>(std::countr_zero(hash));
+    } else {
+        // uniform in (0, 1]
+        double u = static_cast<double>((hash >> 11) + 1) * 0x1.0p-53;
+        return static_cast<size_t>(std::log(u) / std::log1p(-config::p));
+    }
 }
 
-struct Constants {
-    static constexpr config::Key MIN_KEY = std::numeric_limits<config::Key>::min();
-    static constexpr config::Key MAX_KEY = std::numeric_limits<config::Key>::max();
+}
+
+// With integral keys ordered by std::less, the sentinels hold the extreme values of the key type, so that
+// searches can compare keys without checking for the right sentinel: no key is greater than its key.
+// Sentinels are still told apart by their flags, so these values remain valid keys.
+template<typename K, typename Compare>
+struct KeyTraits {
+    static constexpr bool kSentinelKeys = std::is_integral_v<K>
+            && (std::is_same_v<Compare, std::less<K>> || std::is_same_v<Compare, std::less<>>);
+
+    static auto LeftSentinelKey() -> K {
+        if constexpr (kSentinelKeys) return std::numeric_limits<K>::min();
+        else return K{};
+    }
+
+    static auto RightSentinelKey() -> K {
+        if constexpr (kSentinelKeys) return std::numeric_limits<K>::max();
+        else return K{};
+    }
 };
 
+// hints the CPU to start loading the cache line at addr; a no-op where the builtin is unavailable
+inline auto Prefetch(void const* addr) -> void {
+#if defined(__GNUC__) || defined(__clang__)
+    __builtin_prefetch(addr);
+#endif
+}
+
 #define Debug if constexpr (config::DebugEnabled())
 
 constexpr auto Assert(bool condition) -> void { Debug { assert(condition); } }
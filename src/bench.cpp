@@ -0,0 +1,237 @@
+// Benchmark harness for batch operations of SkipList against std::set and a flat sorted sequence.
+//
+// usage: pbsl_bench [--threads=1,2,4,8] [--n=10000000] [--m=1000000] [--reps=5]
+//                   [--distributions=uniform,clustered,skewed,append,interleaved]
+//                   [--ops=insert,erase,find,contains] [--impls=pbsl,sharded,set,flat] [--format=csv|json]
+//
+// find looks up the sorted batch with predecessors and successors, and contains only tests membership; sharded lists
+// have no find, so only their contains rows compare to pbsl
+//
+// Parlay reads the number of workers once, when its scheduler starts, so each thread count is measured
+// in a fresh child process started with PARLAY_NUM_THREADS set; the parent only collects their output.
+
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+#include <map>
+#include <optional>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <parlay/parallel.h>
+#include <parlay/primitives.h>
+#include <parlay/sequence.h>
+
+#include "skip_list.hpp"
+#include "sharded_skip_list.hpp"
+#include "common/bench.hpp"
+#include "common/testcase.hpp"
+#include "common/util.hpp"
+
+using namespace pbsl;
+using util::types::Seq;
+using K = size_t;
+
+namespace {
+
+using Args = std::map<std::string, std::string>;
+
+auto ParseArgs(int argc, char** argv) -> Args {
+    Args args = {
+            {"threads", "1,2,4,8"},
+            {"n", "10000000"},
+            {"m", "1000000"},
+            {"reps", "5"},
+            {"distributions", "uniform,clustered,skewed,append,interleaved"},
+            {"ops", "insert,erase,find,contains"},
+            {"impls", "pbsl,sharded,set,flat"},
+            {"format", "csv"},
+    };
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg.rfind("--", 0) != 0) continue;
+        size_t eq = arg.find('=');
+        if (eq == std::string::npos) args[arg.substr(2)] = "";
+        else args[arg.substr(2, eq - 2)] = arg.substr(eq + 1);
+    }
+    return args;
+}
+
+auto Split(std::string const& list) -> std::vector<std::string> {
+    std::vector<std::string> items;
+    size_t start = 0;
+    while (start <= list.size()) {
+        size_t comma = std::min(list.find(',', start), list.size());
+        if (comma > start) items.push_back(list.substr(start, comma - start));
+        start = comma + 1;
+    }
+    return items;
+}
+
+auto const kOps = std::set<std::string>{"insert", "erase", "find", "contains"};
+auto const kImpls = std::set<std::string>{"pbsl", "sharded", "set", "flat"};
+
+// times one operation of one implementation; returns nothing for combinations that are not supported
+auto Measure(std::string const& impl, std::string const& op, Test const& test, size_t reps)
+        -> std::optional<std::vector<double>> {
+    auto const& initial = test.initial;
+    auto const& batch = test.batch;
+    if (impl == "pbsl") {
+        if (op == "insert") {
+            return Repeat(reps, [&]() { return SkipList<K>::FromOrderedKeys(initial); },
+                          [&](SkipList<K>& sl) { sl.InsertOrdered(batch); });
+        }
+        if (op == "erase") {
+            auto all = parlay::merge(initial, batch);
+            return Repeat(reps, [&]() { return SkipList<K>::FromOrderedKeys(all); },
+                          [&](SkipList<K>& sl) { sl.EraseOrdered(batch); });
+        }
+        if (op == "find") {
+            auto sl = SkipList<K>::FromOrderedKeys(initial);
+            return Repeat(reps, []() { return 0; }, [&](int) { return sl.FindOrdered(batch); });
+        }
+        if (op == "contains") {
+            auto sl = SkipList<K>::FromOrderedKeys(initial);
+            return Repeat(reps, []() { return 0; }, [&](int) { return sl.Contains(batch); });
+        }
+    }
+    // range-partitioned into one SkipList per worker
+    if (impl == "sharded") {
+        using Sharded = ShardedSkipList<K>;
+        size_t n_shards = parlay::num_workers();
+        if (op == "insert") {
+            return Repeat(reps, [&]() { return Sharded::FromOrderedKeys(initial, n_shards); },
+                          [&](Sharded& sl) { sl.InsertOrdered(batch); });
+        }
+        if (op == "erase") {
+            auto all = parlay::merge(initial, batch);
+            return Repeat(reps, [&]() { return Sharded::FromOrderedKeys(all, n_shards); },
+                          [&](Sharded& sl) { sl.EraseOrdered(batch); });
+        }
+        if (op == "contains") {
+            auto sl = Sharded::FromOrderedKeys(initial, n_shards);
+            return Repeat(reps, []() { return 0; }, [&](int) { return sl.Contains(batch); });
+        }
+    }
+    // sequential baseline
+    if (impl == "set") {
+        if (op == "insert") {
+            return Repeat(reps, [&]() { return std::set<K>(initial.begin(), initial.end()); },
+                          [&](std::set<K>& set) { for (K key : batch) set.insert(set.end(), key); });
+        }
+        if (op == "erase") {
+            return Repeat(reps, [&]() {
+                auto set = std::set<K>(initial.begin(), initial.end());
+                set.insert(batch.begin(), batch.end());
+                return set;
+            }, [&](std::set<K>& set) { for (K key : batch) set.erase(key); });
+        }
+        if (op == "find" || op == "contains") {
+            auto set = std::set<K>(initial.begin(), initial.end());
+            return Repeat(reps, []() { return 0; }, [&](int) {
+                size_t found = 0;
+                for (K key : batch) found += set.contains(key);
+                return found;
+            });
+        }
+    }
+    // parallel baseline: a sorted array, rebuilt by every update
+    if (impl == "flat") {
+        if (op == "insert") {
+            return Repeat(reps, [&]() { return initial; },
+                          [&](Seq<K>& flat) { flat = parlay::merge(flat, batch); });
+        }
+        if (op == "erase") {
+            return Repeat(reps, [&]() { return parlay::merge(initial, batch); }, [&](Seq<K>& flat) {
+                flat = parlay::filter(flat, [&](K key) { return !std::binary_search(batch.begin(), batch.end(), key); });
+            });
+        }
+        if (op == "find" || op == "contains") {
+            return Repeat(reps, []() { return 0; }, [&](int) {
+                return parlay::map(batch, [&](K key) { return std::binary_search(initial.begin(), initial.end(), key); });
+            });
+        }
+    }
+    return std::nullopt;
+}
+
+// runs every configuration with the current number of workers and prints a row for each
+auto RunChild(Args const& args) -> int {
+    size_t threads = parlay::num_workers();
+    size_t n = std::stoull(args.at("n"));
+    size_t m = std::stoull(args.at("m"));
+    size_t reps = std::stoull(args.at("reps"));
+    for (auto const& op : Split(args.at("ops"))) {
+        if (!kOps.contains(op)) {
+            std::cerr << "unknown op " << op << std::endl;
+            return 1;
+        }
+    }
+    for (auto const& impl : Split(args.at("impls"))) {
+        if (!kImpls.contains(impl)) {
+            std::cerr << "unknown impl " << impl << std::endl;
+            return 1;
+        }
+    }
+    for (auto const& name : Split(args.at("distributions"))) {
+        auto distribution = ParseDistribution(name);
+        if (!distribution) {
+            std::cerr << "unknown distribution " << name << std::endl;
+            return 1;
+        }
+        auto test = GenerateTest(TestDescription(threads, n, m, *distribution));
+        for (auto const& op : Split(args.at("ops"))) {
+            for (auto const& impl : Split(args.at("impls"))) {
+                auto samples = Measure(impl, op, test, reps);
+                // e.g. find on sharded lists, whose rows would not be comparable to the others
+                if (!samples) continue;
+                Row row{impl, op, name, threads, test.initial.size(), test.batch.size(), reps, Summarize(*samples)};
+                std::cout << (args.at("format") == "json" ? ToJson(row) : ToCsv(row)) << std::endl;
+            }
+        }
+    }
+    return 0;
+}
+
+// starts a child process per thread count and concatenates their rows
+auto RunSweep(Args const& args, char const* self) -> int {
+    bool json = args.at("format") == "json";
+    std::string forwarded;
+    for (auto const& [key, value] : args) {
+        if (key != "threads") forwarded += " --" + key + "=" + value;
+    }
+    std::cout << (json ? "[" : CsvHeader()) << std::endl;
+    bool first = true;
+    for (auto const& threads : Split(args.at("threads"))) {
+        env::Set(env::PARLAY_NUM_THREADS, threads.c_str());
+        std::string command = std::string(self) + " --child" + forwarded;
+        FILE* child = popen(command.c_str(), "r");
+        if (child == nullptr) {
+            std::cerr << "failed to start " << command << std::endl;
+            return 1;
+        }
+        char buffer[4096];
+        while (fgets(buffer, sizeof(buffer), child) != nullptr) {
+            if (json && !first) std::cout << ",\n";
+            std::string line(buffer);
+            if (json && !line.empty() && line.back() == '\n') line.pop_back();
+            std::cout << line << std::flush;
+            first = false;
+        }
+        if (pclose(child) != 0) {
+            std::cerr << "child with " << threads << " threads failed" << std::endl;
+            return 1;
+        }
+    }
+    if (json) std::cout << "\n]" << std::endl;
+    return 0;
+}
+
+}
+
+int main(int argc, char** argv) {
+    auto args = ParseArgs(argc, argv);
+    if (args.contains("child")) return RunChild(args);
+    return RunSweep(args, argv[0]);
+}
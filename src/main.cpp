@@ -1,10 +1,22 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
 #include <iostream>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <utility>
 
 #include "skip_list.hpp"
+#include "unrolled_skip_list.hpp"
+#include "batching_writer.hpp"
 #include "common/timer.hpp"
 #include "pbsl/config.hpp"
 #include "common/util.hpp"
 #include "common/testcase.hpp"
+#include "common/bench.hpp"
 
 using namespace pbsl;
 using util::types::Seq;
@@ -16,12 +28,12 @@ void TestSmallMerge() {
     for (size_t i = 1; i < n; ++i) {
         keys.push_back(i * 2);
     }
-    auto sl = SkipList::FromOrderedKeys(keys);
+    auto sl = SkipList<K>::FromOrderedKeys(keys);
     auto nodes = sl.DebugGetNodes();
     size_t height = nodes.front()->Height();
     for (size_t level = 0; level < height; ++level) {
         std::cout << level << ": ";
-        for (Node* node = nodes.front(); node != nullptr; node = node->Next(level)) {
+        for (auto node = nodes.front(); node != nullptr; node = node->Next(level)) {
             std::cout << node->key << " ";
         }
         std::cout << std::endl;
@@ -37,7 +49,7 @@ void TestSmallMerge() {
     nodes = sl.DebugGetNodes();
     for (size_t level = 0; level < sl.Height(); ++level) {
         std::cout << level << ": ";
-        for (Node* node = nodes.front(); node != nullptr; node = node->Next(level)) {
+        for (auto node = nodes.front(); node != nullptr; node = node->Next(level)) {
             std::cout << node->key << " ";
         }
         std::cout << std::endl;
@@ -50,7 +62,7 @@ void TestMaxSize() {
     size_t const m = 2e7;
     TestDescription desc(8, m, m);
     auto test = GenerateTest(desc);
-    auto sl = SkipList::FromOrderedKeys(test.initial);
+    auto sl = SkipList<K>::FromOrderedKeys(test.initial);
     auto duration = MeasureTimeMillis([&]() {
         sl.InsertOrdered(test.batch);
     });
@@ -62,7 +74,7 @@ void TestDurationByM() {
     for (size_t m : {1e4, 1e5, 1e6, 2e6, 4e6, 6e6, 8e6, 1e7, 2e7}) {
         TestDescription desc(8, n, m);
         auto test = GenerateTest(desc);
-        auto sl = SkipList::FromOrderedKeys(test.initial);
+        auto sl = SkipList<K>::FromOrderedKeys(test.initial);
         auto duration = MeasureTimeMillis([&]() {
             sl.InsertOrdered(test.batch);
         });
@@ -70,11 +82,38 @@ void TestDurationByM() {
     }
 }
 
+// per-key insertion time of small batches with finger search and with the parallel merge,
+// to pick config::small_batch_size
+void TestSmallBatchCrossover() {
+    size_t const n = 2e7;
+    size_t const rounds = 1000;
+    size_t small_batch_size = config::small_batch_size;
+    for (size_t m : {1, 4, 16, 64, 256, 1024, 4096}) {
+        TestDescription desc(8, n, m * rounds);
+        auto test = GenerateTest(desc);
+        // round r inserts every rounds-th key of the batch, so that each batch is spread over the whole list
+        auto batches = parlay::tabulate(rounds, [&](size_t r) {
+            return parlay::tabulate(m, [&](size_t i) { return test.batch[i * rounds + r]; });
+        });
+        std::cout << m << ":";
+        for (size_t threshold : {size_t{0}, m}) {
+            config::small_batch_size = threshold;
+            auto sl = SkipList<K>::FromOrderedKeys(test.initial);
+            auto duration = MeasureTimeMillis([&]() {
+                for (auto const& batch : batches) sl.InsertOrdered(batch);
+            });
+            std::cout << " " << (threshold == 0 ? "merge " : "finger ") << static_cast<long double>(duration) / (m * rounds);
+        }
+        std::cout << std::endl;
+    }
+    config::small_batch_size = small_batch_size;
+}
+
 void TestDurationByMWithEqualN() {
     for (size_t m : {1e4, 1e5, 1e6, 2e6, 4e6, 6e6, 8e6, 1e7, 2e7}) {
         TestDescription desc(8, m, m);
         auto test = GenerateTest(desc);
-        auto sl = SkipList::FromOrderedKeys(test.initial);
+        auto sl = SkipList<K>::FromOrderedKeys(test.initial);
         auto duration = MeasureTimeMillis([&]() {
             sl.InsertOrdered(test.batch);
         });
@@ -82,31 +121,366 @@ void TestDurationByMWithEqualN() {
     }
 }
 
-void TestSpeedup() {
+void TestEraseDurationByM() {
     size_t const n = 2e7;
-    TestDescription desc(8, n, n);
+    for (size_t m : {1e4, 1e5, 1e6, 2e6, 4e6, 6e6, 8e6, 1e7, 2e7}) {
+        TestDescription desc(8, n, m);
+        auto test = GenerateTest(desc);
+        auto sl = SkipList<K>::FromOrderedKeys(test.initial);
+        sl.InsertOrdered(test.batch);
+        auto duration = MeasureTimeMillis([&]() {
+            sl.EraseOrdered(test.batch);
+        });
+        std::cout << m << ": " << static_cast<long double>(duration) / m  << "," << std::endl;
+    }
+}
+
+// erasing the tallest node right after a merge may lower the list below the critical level of the erase, when the
+// node stands two or more levels above the rest; the layer cached by the merge must not survive that, or the next
+// merge reads the erased node from it. Such towers are rare, so the list is rebuilt under many seeds
+void TestEraseTallestAfterMerge() {
+    size_t const n = 1e5;
+    TestDescription desc(8, n, n / 2);
+    auto test = GenerateTest(desc);
+    uint64_t seed = config::seed;
+    // a single key goes through the merge as well
+    size_t small_batch_size = std::exchange(config::small_batch_size, 0);
+    for (uint64_t s = 0; s < 64; ++s) {
+        config::seed = s;
+        auto sl = SkipList<K>::FromOrderedKeys(test.initial);
+        sl.InsertOrdered(test.batch);
+        size_t size = sl.Size();
+        auto nodes = sl.DebugGetNodes();
+        Seq<K> tallest = {(*std::max_element(nodes.begin() + 1, nodes.end() - 1, [](auto const* lhs, auto const* rhs) {
+            return lhs->Height() < rhs->Height();
+        }))->key};
+        size_t height = sl.Height();
+        sl.EraseOrdered(tallest);
+        if (height - sl.Height() < 2) continue;
+        sl.InsertOrdered(tallest);
+        std::cout << "seed " << s << ": height " << height << " -> " << sl.Height() << ", size "
+                  << (sl.Size() == size ? "ok" : "wrong") << std::endl;
+    }
+    config::seed = seed;
+    config::small_batch_size = small_batch_size;
+}
+
+// dropping every fourth key by predicate and by an explicit batch, and a contiguous tenth of the keys by range
+void TestRemoveDuration() {
+    size_t const n = 2e7;
+    TestDescription desc(8, n, 0);
     auto test = GenerateTest(desc);
-    std::vector<size_t> durs;
-    for (size_t p = 1; p <= 8; ++p) {
-        std::cout << "p = " << p << ": ";
-        env::SetNThreads(p);
-        auto sl = SkipList::FromOrderedKeys(test.initial);
+    auto sl = SkipList<K>::FromOrderedKeys(test.initial);
+    auto duration = MeasureTimeMillis([&]() {
+        sl.RemoveIf([](K key) { return key % 4 == 0; });
+    });
+    std::cout << "remove if: " << duration << " ms" << std::endl;
+    sl = SkipList<K>::FromOrderedKeys(test.initial);
+    auto batch = parlay::filter(test.initial, [](K key) { return key % 4 == 0; });
+    duration = MeasureTimeMillis([&]() {
+        sl.EraseOrdered(batch);
+    });
+    std::cout << "erase ordered: " << duration << " ms" << std::endl;
+    sl = SkipList<K>::FromOrderedKeys(test.initial);
+    duration = MeasureTimeMillis([&]() {
+        sl.EraseRange(test.initial[n / 2], test.initial[n / 2 + n / 10]);
+    });
+    std::cout << "erase range: " << duration << " ms" << std::endl;
+}
+
+void TestFindDurationByM() {
+    size_t const n = 2e7;
+    for (size_t m : {1e4, 1e5, 1e6, 2e6, 4e6, 6e6, 8e6, 1e7, 2e7}) {
+        TestDescription desc(8, n, m);
+        auto test = GenerateTest(desc);
+        auto sl = SkipList<K>::FromOrderedKeys(test.initial);
         auto duration = MeasureTimeMillis([&]() {
-            sl.InsertOrdered(test.batch);
+            sl.FindOrdered(test.batch);
         });
-        std::cout << duration << std::endl;
-        durs.push_back(duration);
+        std::cout << m << ": " << static_cast<long double>(duration) / m  << "," << std::endl;
     }
-    //for (size_t d : durs) std::cout << d << std::endl;
-    std::cout << std::endl;
-    for (size_t i = 0; i < durs.size(); ++i) std::cout << static_cast<double>(durs[0]) / static_cast<double>(durs[i]) << std::endl;
+}
+
+// unsorted lookups, interleaved with prefetching and one descent at a time
+void TestContainsDuration() {
+    size_t const n = 2e7;
+    size_t const m = 1e7;
+    TestDescription desc(8, n, m);
+    auto test = GenerateTest(desc);
+    auto sl = SkipList<K>::FromOrderedKeys(test.initial);
+    // half of the queries are present
+    auto queries = parlay::tabulate(m, [&](size_t i) { return i % 2 == 0 ? test.initial[i * (n / m)] : test.batch[i]; });
+    queries = parlay::random_shuffle(queries);
+    auto duration = MeasureTimeMillis([&]() {
+        sl.Contains(queries);
+    });
+    std::cout << "grouped: " << static_cast<long double>(duration) / m << std::endl;
+    duration = MeasureTimeMillis([&]() {
+        sl.ContainsInGroups<1>(queries);
+    });
+    std::cout << "naive: " << static_cast<long double>(duration) / m << std::endl;
+}
+
+// unsorted lookups in the list and in a frozen copy of it
+void TestFrozenContainsDuration() {
+    size_t const n = 2e7;
+    size_t const m = 1e7;
+    TestDescription desc(8, n, m);
+    auto test = GenerateTest(desc);
+    auto sl = SkipList<K>::FromOrderedKeys(test.initial);
+    auto queries = parlay::tabulate(m, [&](size_t i) { return i % 2 == 0 ? test.initial[i * (n / m)] : test.batch[i]; });
+    queries = parlay::random_shuffle(queries);
+    std::optional<SkipList<K>::FrozenIndex> frozen;
+    auto duration = MeasureTimeMillis([&]() {
+        frozen.emplace(sl.Freeze());
+    });
+    std::cout << "freeze: " << duration << " ms" << std::endl;
+    duration = MeasureTimeMillis([&]() {
+        sl.Contains(queries);
+    });
+    std::cout << "list: " << static_cast<long double>(duration) / m << std::endl;
+    duration = MeasureTimeMillis([&]() {
+        frozen->Contains(queries);
+    });
+    std::cout << "frozen: " << static_cast<long double>(duration) / m << std::endl;
+}
+
+void TestBytesPerKey() {
+    size_t const n = 2e7;
+    TestDescription desc(8, n, 0);
+    auto test = GenerateTest(desc);
+    std::optional<SkipList<K>> sl;
+    auto duration = MeasureTimeMillis([&]() {
+        sl.emplace(SkipList<K>::FromOrderedKeys(test.initial));
+    });
+    std::cout << "build: " << duration << " ms" << std::endl;
+    std::cout << "bytes per key: " << static_cast<long double>(sl->AllocatedBytes()) / n << std::endl;
+}
+
+// memory, build, scan, lookups and batch insertion of the list and of its unrolled variant
+void TestUnrolledDuration() {
+    size_t const n = 2e7;
+    size_t const m = 1e6;
+    TestDescription desc(8, n, m);
+    auto test = GenerateTest(desc);
+    auto queries = parlay::tabulate(m, [&](size_t i) { return i % 2 == 0 ? test.initial[i * (n / m)] : test.batch[i]; });
+    queries = parlay::random_shuffle(queries);
+    auto buffer = Seq<K>::uninitialized(n + m);
+    auto run = [&]<typename List>(char const* name) {
+        std::optional<List> sl;
+        auto build = MeasureTimeMillis([&]() { sl.emplace(List::FromOrderedKeys(test.initial)); });
+        auto scan = MeasureTimeMillis([&]() { sl->CopyTo(buffer.begin()); });
+        auto contains = MeasureTimeMillis([&]() { sl->Contains(queries); });
+        auto insert = MeasureTimeMillis([&]() { sl->InsertOrdered(test.batch); });
+        std::cout << name << ": " << static_cast<long double>(sl->AllocatedBytes()) / (n + m) << " bytes per key, build "
+                  << build << " ms, scan " << scan << " ms, contains " << static_cast<long double>(contains) / m
+                  << ", insert " << static_cast<long double>(insert) / m << std::endl;
+    };
+    run.template operator()<SkipList<K>>("list");
+    run.template operator()<UnrolledSkipList<K>>("unrolled");
+}
+
+void TestClearDuration() {
+    size_t const n = 4e7;
+    TestDescription desc(8, n, 0);
+    auto test = GenerateTest(desc);
+    auto sl = SkipList<K>::FromOrderedKeys(test.initial);
+    auto duration = MeasureTimeMillis([&]() {
+        sl.Clear();
+    });
+    std::cout << "clear: " << duration << " ms" << std::endl;
+    // the nodes freed by Clear are reused from the pools
+    duration = MeasureTimeMillis([&]() {
+        sl.InsertOrdered(test.initial);
+    });
+    std::cout << "refill: " << duration << " ms" << std::endl;
+}
+
+void TestScanDuration() {
+    size_t const n = 4e7;
+    TestDescription desc(8, n, 0);
+    auto test = GenerateTest(desc);
+    auto sl = SkipList<K>::FromOrderedKeys(test.initial);
+    auto buffer = Seq<K>::uninitialized(n);
+    auto duration = MeasureTimeMillis([&]() {
+        sl.CopyTo(buffer.begin());
+    });
+    std::cout << "copy: " << duration << " ms" << std::endl;
+    K sum = 0;
+    duration = MeasureTimeMillis([&]() {
+        sum = sl.Reduce([](K key) { return key; }, parlay::plus<K>());
+    });
+    std::cout << "reduce: " << duration << " ms (" << sum << ")" << std::endl;
+}
+
+// sums over key ranges from the maintained aggregates and from a reduction over the range
+void TestRangeAggregateDuration() {
+    size_t const n = 2e7;
+    size_t const queries = 1000;
+    TestDescription desc(8, n, 0);
+    auto test = GenerateTest(desc);
+    using List = SkipList<K, K, std::less<K>, SumOfValues<K>>;
+    auto entries = parlay::map(test.initial, [](K key) { return List::Entry(key, key % 1024); });
+    auto sl = List::FromOrderedEntries(entries);
+    // every range holds a tenth of the keys
+    auto range = [&](size_t i) {
+        size_t first = i * (n / queries) / 2;
+        return std::make_pair(test.initial[first], test.initial[first + n / 10]);
+    };
+    K sum = 0;
+    auto duration = MeasureTimeMillisPrecise([&]() {
+        for (size_t i = 0; i < queries; ++i) sum += sl.RangeAggregate(range(i).first, range(i).second);
+    });
+    std::cout << "aggregate: " << duration / queries << " ms (" << sum << ")" << std::endl;
+    sum = 0;
+    duration = MeasureTimeMillisPrecise([&]() {
+        for (size_t i = 0; i < queries; ++i) {
+            sum += sl.Reduce(range(i).first, range(i).second, [](K, K value) { return value; }, parlay::plus<K>());
+        }
+    });
+    std::cout << "reduce: " << duration / queries << " ms (" << sum << ")" << std::endl;
+}
+
+void TestSplitJoinDuration() {
+    size_t const n = 2e7;
+    TestDescription desc(8, n, n);
+    auto test = GenerateTest(desc);
+    auto sl = SkipList<K>::FromOrderedKeys(test.initial);
+    auto duration = MeasureTimeMillis([&]() {
+        for (size_t i = 0; i < 1000; ++i) {
+            auto [left, right] = std::move(sl).Split(test.initial[i * (n / 1000)]);
+            sl = SkipList<K>::Join(std::move(left), std::move(right));
+        }
+    });
+    std::cout << "split + join: " << static_cast<long double>(duration) / 1000 << " ms" << std::endl;
+    auto other = SkipList<K>::FromOrderedKeys(test.batch);
+    duration = MeasureTimeMillis([&]() {
+        sl.Union(std::move(other));
+    });
+    std::cout << "union: " << duration << " ms" << std::endl;
+}
+
+// where a large merge spends its time; needs PBSL_STATS to be defined
+void TestMergePhases() {
+    size_t const n = 2e7;
+    size_t const m = 1e6;
+    TestDescription desc(8, n, m);
+    auto test = GenerateTest(desc);
+    auto sl = SkipList<K>::FromOrderedKeys(test.initial);
+    sl.ResetStats();
+    sl.InsertOrdered(test.batch);
+    auto const& stats = sl.GetStats();
+    auto ms = [](uint64_t ns) { return static_cast<long double>(ns) / 1e6; };
+    std::cout << "create nodes: " << ms(stats.create_nodes_ns) << " ms" << std::endl;
+    std::cout << "link nodes: " << ms(stats.link_nodes_ns) << " ms" << std::endl;
+    std::cout << "coerce height: " << ms(stats.coerce_height_ns) << " ms" << std::endl;
+    std::cout << "get layer: " << ms(stats.get_layer_ns) << " ms" << std::endl;
+    std::cout << "merge higher levels: " << ms(stats.merge_higher_levels_ns) << " ms" << std::endl;
+    std::cout << "find starting nodes: " << ms(stats.find_starting_nodes_ns) << " ms" << std::endl;
+    std::cout << "prepare insert: " << ms(stats.prepare_insert_ns) << " ms" << std::endl;
+    std::cout << "link rewiring: " << ms(stats.link_rewiring_ns) << " ms" << std::endl;
+    std::cout << "update spans: " << ms(stats.update_spans_ns) << " ms" << std::endl;
+    std::cout << "critical layer: " << stats.crit_layer_nodes << " nodes" << std::endl;
+    std::cout << "visits per descent: " << static_cast<long double>(stats.prepare_insert_visits) / m << std::endl;
+    std::cout << "bytes allocated: " << stats.bytes_allocated << std::endl;
+}
+
+// latency of snapshot lookups from a separate thread, idle and while large batches are merged
+void TestSnapshotReadLatency() {
+    size_t const n = 2e7;
+    size_t const m = 1e6;
+    size_t const rounds = 8;
+    TestDescription desc(8, n, m * rounds);
+    auto test = GenerateTest(desc);
+    auto sl = SkipList<K>::FromOrderedKeys(test.initial);
+    auto measure = [&](std::atomic<bool> const& stop) {
+        std::vector<double> latencies;
+        for (size_t i = 0; !stop.load(); i = (i + 7919) % n) {
+            auto snapshot = sl.GetSnapshot();
+            latencies.push_back(MeasureTimeMillisPrecise([&]() { Consume(snapshot.Find(test.initial[i])); }) * 1e6);
+        }
+        return Summarize(latencies);
+    };
+    auto print = [](char const* name, Stats const& stats) {
+        std::cout << name << ": median " << stats.median << " ns, p99 " << stats.p99 << " ns, max " << stats.max
+                  << " ns" << std::endl;
+    };
+    std::atomic<bool> stop = false;
+    Stats idle{};
+    std::thread reader([&]() { idle = measure(stop); });
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+    stop = true;
+    reader.join();
+    print("idle", idle);
+    stop = false;
+    Stats busy{};
+    reader = std::thread([&]() { busy = measure(stop); });
+    for (size_t r = 0; r < rounds; ++r) {
+        sl.InsertOrdered(parlay::tabulate(m, [&](size_t i) { return test.batch[i * rounds + r]; }));
+    }
+    stop = true;
+    reader.join();
+    print("during merges", busy);
+}
+
+// single-key insertions from many threads, through a BatchingWriter and one at a time under a lock
+void TestBatchingWriterDuration() {
+    size_t const n = 2e7;
+    size_t const m = 1e6;
+    size_t const n_threads = 16;
+    TestDescription desc(8, n, m);
+    auto test = GenerateTest(desc);
+    // thread t inserts every n_threads-th key of the batch, in random order
+    auto shuffled = parlay::random_shuffle(test.batch);
+    auto run = [&](auto&& insert) {
+        return MeasureTimeMillis([&]() {
+            std::vector<std::thread> threads;
+            for (size_t t = 0; t < n_threads; ++t) {
+                threads.emplace_back([&, t]() {
+                    for (size_t i = t; i < m; i += n_threads) insert(shuffled[i]);
+                });
+            }
+            for (auto& thread : threads) thread.join();
+        });
+    };
+    auto sl = SkipList<K>::FromOrderedKeys(test.initial);
+    std::optional<BatchingWriter<SkipList<K>>> writer(std::in_place, sl);
+    auto duration = run([&](K key) { writer->Insert(key); });
+    duration += MeasureTimeMillis([&]() { writer.reset(); });
+    std::cout << "batched: " << static_cast<long double>(duration) / m << std::endl;
+    sl = SkipList<K>::FromOrderedKeys(test.initial);
+    std::mutex mutex;
+    duration = run([&](K key) {
+        std::lock_guard lock(mutex);
+        sl.InsertOrdered(Seq<K>(1, key));
+    });
+    std::cout << "locked: " << static_cast<long double>(duration) / m << std::endl;
+}
+
+// cold start from a saved list against building it from the keys again
+void TestColdStart() {
+    size_t const n = 2e7;
+    TestDescription desc(8, n, 1);
+    auto test = GenerateTest(desc);
+    std::string const path = "pbsl_cold_start.bin";
+    {
+        auto sl = SkipList<K>::FromOrderedKeys(test.initial);
+        std::cout << "save: " << MeasureTimeMillis([&]() { sl.Save(path); }) << " ms" << std::endl;
+    }
+    std::optional<SkipList<K>> loaded;
+    std::cout << "load: " << MeasureTimeMillis([&]() { loaded = SkipList<K>::Load(path); }) << " ms" << std::endl;
+    loaded.reset();
+    std::optional<SkipList<K>> built;
+    std::cout << "build: " << MeasureTimeMillis([&]() { built = SkipList<K>::FromOrderedKeys(test.initial); })
+              << " ms" << std::endl;
+    std::remove(path.c_str());
 }
 
 void TestWithSetNWorkers() {
     size_t const n = 2e7;
     TestDescription desc(8, n, n);
     auto test = GenerateTest(desc);
-    auto sl = SkipList::FromOrderedKeys(test.initial);
+    auto sl = SkipList<K>::FromOrderedKeys(test.initial);
     auto duration = MeasureTimeMillis([&]() {
         sl.InsertOrdered(test.batch);
     });